@@ -0,0 +1,238 @@
+/*
+ * MessagePack for Lua
+ *
+ * Copyright (C) 2010 Nobuyuki Kubota
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef MSGPACK_LUA_BUFFER_PACKER_HPP_
+#define MSGPACK_LUA_BUFFER_PACKER_HPP_
+
+#include <algorithm>
+#include <cstring>
+#include <vector>
+#include <msgpack.hpp>
+
+namespace msgpack {
+namespace lua {
+
+/**
+ * @brief Packer writing to an sbuffer which can rewrite data already packed.
+ *
+ * This allows LuaObjects to write a map header before the number of its
+ * entries is known, and to fix it after all entries have been packed.
+ * An ext header is written in the same way before its payload is packed.
+ *
+ * A fixed header is usually shorter than the reserved space. The rest of
+ * the space is left as a gap and all gaps are removed by compact at once,
+ * so that nested headers do not move the data after them once per level.
+ */
+class BufferPacker : public msgpack::packer<msgpack::sbuffer> {
+public:
+  static const size_t MaxMapHeaderSize = 5;
+  static const size_t MaxExtHeaderSize = 6;
+
+  explicit BufferPacker(msgpack::sbuffer& buffer)
+    : msgpack::packer<msgpack::sbuffer>(buffer), buffer_(buffer),
+      gap_bytes_(0) {}
+
+  msgpack::sbuffer& buffer() { return buffer_; }
+
+  /**
+   * @brief Reserves the space for a map header.
+   *
+   * @return The offset of the reserved header, which has to be passed
+   * to fixMapHeader.
+   */
+  size_t reserveMapHeader() {
+    static const char Placeholder[MaxMapHeaderSize] = {'\xdf', 0, 0, 0, 0};
+    size_t offset = buffer_.size();
+    buffer_.write(Placeholder, MaxMapHeaderSize);
+    return offset;
+  }
+
+  /**
+   * @brief Writes the actual map header at the reserved offset.
+   *
+   * The header is shrunk to fixmap or map16 when possible, leaving a gap
+   * before the entries.
+   */
+  void fixMapHeader(size_t offset, uint32_t n) {
+    char header[MaxMapHeaderSize];
+    size_t header_size;
+    if (n < 16) {
+      header[0] = static_cast<char>(0x80 | n);
+      header_size = 1;
+    } else if (n < 65536) {
+      header[0] = '\xde';
+      header[1] = static_cast<char>(n >> 8);
+      header[2] = static_cast<char>(n);
+      header_size = 3;
+    } else {
+      header[0] = '\xdf';
+      header[1] = static_cast<char>(n >> 24);
+      header[2] = static_cast<char>(n >> 16);
+      header[3] = static_cast<char>(n >> 8);
+      header[4] = static_cast<char>(n);
+      header_size = 5;
+    }
+
+    replaceHeader(offset, MaxMapHeaderSize, header, header_size);
+  }
+
+  /**
+   * @brief Reserves the space for an ext header.
+   *
+   * @return The offset of the reserved header, which has to be passed
+   * to fixExtHeader.
+   */
+  size_t reserveExtHeader() {
+    static const char Placeholder[MaxExtHeaderSize] = {'\xc9', 0, 0, 0, 0, 0};
+    size_t offset = buffer_.size();
+    buffer_.write(Placeholder, MaxExtHeaderSize);
+    return offset;
+  }
+
+  /**
+   * @brief Writes the actual ext header at the reserved offset. Data
+   * packed after the header is the payload.
+   *
+   * The header is shrunk to ext8 or ext16 when possible, leaving a gap
+   * before the payload. Gaps in the payload are not counted in its size.
+   */
+  void fixExtHeader(size_t offset, int8_t type) {
+    size_t n = buffer_.size() - offset - MaxExtHeaderSize - gapsAfter(offset);
+    char header[MaxExtHeaderSize];
+    size_t header_size;
+    if (n < 256) {
+      header[0] = '\xc7';
+      header[1] = static_cast<char>(n);
+      header_size = 3;
+    } else if (n < 65536) {
+      header[0] = '\xc8';
+      header[1] = static_cast<char>(n >> 8);
+      header[2] = static_cast<char>(n);
+      header_size = 4;
+    } else {
+      header[0] = '\xc9';
+      header[1] = static_cast<char>(n >> 24);
+      header[2] = static_cast<char>(n >> 16);
+      header[3] = static_cast<char>(n >> 8);
+      header[4] = static_cast<char>(n);
+      header_size = 6;
+    }
+    header[header_size - 1] = static_cast<char>(type);
+
+    replaceHeader(offset, MaxExtHeaderSize, header, header_size);
+  }
+
+  /**
+   * @brief Removes gaps after the given offset.
+   *
+   * Each byte is moved at most once however deeply headers are nested.
+   * This has to be called before data packed after the offset is used.
+   */
+  void compact(size_t offset) {
+    size_t first = firstGapAfter(offset);
+    if (first == gaps_.size()) return;
+
+    std::sort(gaps_.begin() + first, gaps_.end(), compareGaps);
+    char* p = buffer_.data();
+    size_t out = gaps_[first].offset;
+    for (size_t i = first; i < gaps_.size(); i++) {
+      size_t begin = gaps_[i].offset + gaps_[i].size;
+      size_t end = i + 1 < gaps_.size() ? gaps_[i + 1].offset : buffer_.size();
+      memmove(p + out, p + begin, end - begin);
+      out += end - begin;
+    }
+    gap_bytes_ = gaps_[first].before;
+    gaps_.resize(first);
+    rewind(out);
+  }
+
+  /**
+   * @brief Discards data packed after the given size.
+   */
+  void rewind(size_t size) {
+    if (size < buffer_.size()) {
+      static_cast<msgpack_sbuffer&>(buffer_).size = size;
+    }
+  }
+
+private:
+  struct Gap {
+    size_t offset;
+    size_t size;
+    size_t before; // the total size of gaps added before this
+  };
+
+  static bool compareGaps(const Gap& a, const Gap& b) {
+    return a.offset < b.offset;
+  }
+
+  /**
+   * @brief Writes the header at the beginning of the reserved space and
+   * leaves the rest as a gap.
+   */
+  void replaceHeader(size_t offset, size_t reserved_size, const char* header,
+                     size_t header_size) {
+    memcpy(buffer_.data() + offset, header, header_size);
+    if (header_size == reserved_size) return;
+
+    Gap g;
+    g.offset = offset + header_size;
+    g.size = reserved_size - header_size;
+    g.before = gap_bytes_;
+    gaps_.push_back(g);
+    gap_bytes_ += g.size;
+  }
+
+  /**
+   * @brief Returns the index of the first gap after the offset.
+   *
+   * Gaps are added in the order their headers are fixed, so gaps added
+   * after a header was reserved are exactly those after its offset.
+   */
+  size_t firstGapAfter(size_t offset) const {
+    size_t lo = 0, hi = gaps_.size();
+    while (lo < hi) {
+      size_t mid = lo + (hi - lo) / 2;
+      if (gaps_[mid].offset > offset) hi = mid;
+      else lo = mid + 1;
+    }
+    return lo;
+  }
+
+  /**
+   * @brief Returns the total size of gaps after the offset.
+   */
+  size_t gapsAfter(size_t offset) const {
+    size_t first = firstGapAfter(offset);
+    if (first == gaps_.size()) return 0;
+    return gap_bytes_ - gaps_[first].before;
+  }
+
+private:
+  msgpack::sbuffer& buffer_;
+
+  // Gaps not removed yet, in the order they were left, and their total
+  // size.
+  std::vector<Gap> gaps_;
+  size_t gap_bytes_;
+};
+
+} // namespace lua
+} // namespace msgpack
+
+#endif
@@ -0,0 +1,400 @@
+/*
+ * MessagePack for Lua
+ *
+ * Copyright (C) 2010 Nobuyuki Kubota
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "decoder.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <string>
+#include "dictionary.hpp"
+#include "ext_registry.hpp"
+#include "format.hpp"
+#include "limits.hpp"
+#include "numeric_array.hpp"
+#include "projection.hpp"
+#include "shared_references.hpp"
+
+namespace msgpack {
+namespace lua {
+namespace {
+// The maximum number of entries of a map looked ahead for keys of the
+// array part. Values are skipped to find the next key, so without the
+// limit, values of nested maps would be scanned once per level.
+const uint64_t MaxArrayKeyLookahead = 32;
+} // namespace
+
+Decoder::Decoder(lua_State* L, const Projection* projection,
+                 const Limits* limits, const Dictionary* dictionary)
+  : L(L), projection_(projection), limits_(limits), dictionary_(dictionary),
+    depth_(0), objects_(0), refs_(0), next_ref_(0), dict_(0) {
+}
+
+size_t Decoder::decode(const char* data, size_t size) {
+  int top = lua_gettop(L);
+  depth_ = 0;
+  objects_ = 0;
+  refs_ = 0;
+  next_ref_ = 0;
+  dict_ = 0;
+  if (dictionary_ != NULL) {
+    if (!lua_checkstack(L, 2)) {
+      throw msgpack::unpack_error("too deeply nested");
+    }
+    dictionary_->push(L);
+    dict_ = lua_gettop(L);
+  }
+
+  const char* end = decodeObject(data, data + size, projection_);
+  if (end == NULL) {
+    lua_settop(L, top);
+    return 0;
+  }
+  if (dict_ != 0) lua_remove(L, dict_);
+  return end - data;
+}
+
+const char* Decoder::decodeObject(const char* p, const char* end,
+                                  const Projection* projection) {
+  Header h;
+  if (!readHeader(p, end - p, &h)) return NULL;
+  if (limits_ != NULL) limits_->check(h, depth_, &objects_);
+  p += h.size;
+
+  switch (h.type) {
+  case Header::NIL:
+    lua_pushnil(L);
+    return p;
+
+  case Header::BOOLEAN:
+    lua_pushboolean(L, static_cast<int>(h.value));
+    return p;
+
+    // Lua internally uses double to represent integer. See
+    // LuaObjects::msgpack_unpack.
+  case Header::UNSIGNED_INTEGER:
+    lua_pushnumber(L, h.value);
+    return p;
+
+  case Header::SIGNED_INTEGER:
+    lua_pushnumber(L, static_cast<int64_t>(h.value));
+    return p;
+
+  case Header::FLOAT: {
+    uint32_t bits = static_cast<uint32_t>(h.value);
+    float f;
+    memcpy(&f, &bits, sizeof(f));
+    lua_pushnumber(L, f);
+    return p;
+  }
+
+  case Header::DOUBLE: {
+    double d;
+    memcpy(&d, &h.value, sizeof(d));
+    lua_pushnumber(L, d);
+    return p;
+  }
+
+  case Header::RAW:
+    if (static_cast<uint64_t>(end - p) < h.value) return NULL;
+    lua_pushlstring(L, p, static_cast<size_t>(h.value));
+    if (refs_ != 0 && h.value >= SharedReferences::MinStringSize) {
+      addReference();
+    }
+    return p + h.value;
+
+  case Header::ARRAY:
+    depth_++;
+    p = decodeArray(p, end, h.value, projection);
+    depth_--;
+    return p;
+
+  case Header::MAP:
+    depth_++;
+    if (projection != NULL) {
+      p = decodeProjectedTable(p, end, h.value, projection);
+    } else {
+      p = decodeTable(p, end, h.value);
+    }
+    depth_--;
+    return p;
+
+  case Header::EXT:
+    if (static_cast<uint64_t>(end - p) < h.value) return NULL;
+    if (projection != NULL &&
+        h.ext_type == SharedReferences::EnvelopeExtType) {
+      throw msgpack::unpack_error(
+        "fields cannot be selected in a shared object");
+    }
+    return decodeExt(h.ext_type, p, static_cast<size_t>(h.value));
+
+  case Header::INVALID:
+  default:
+    throw msgpack::unpack_error("invalid type");
+  }
+}
+
+const char* Decoder::decodeArray(const char* p, const char* end, uint64_t n,
+                                 const Projection* projection) {
+  if (!lua_checkstack(L, 3)) {
+    throw msgpack::unpack_error("too deeply nested");
+  }
+
+  // Each element has at least 1 byte. This prevents a broken header from
+  // allocating a huge table.
+  uint64_t narr = std::min<uint64_t>(n, end - p);
+  lua_createtable(L, static_cast<int>(narr), 0);
+  if (refs_ != 0) addReference();
+  for (uint64_t i = 0; i < n; i++) {
+    p = decodeObject(p, end, projection);
+    if (p == NULL) return NULL;
+    lua_rawseti(L, -2, static_cast<int>(i + 1));
+  }
+  return p;
+}
+
+const char* Decoder::decodeTable(const char* p, const char* end, uint64_t n) {
+  if (!lua_checkstack(L, 4)) {
+    throw msgpack::unpack_error("too deeply nested");
+  }
+
+  // Each entry has at least 2 bytes.
+  uint64_t size = std::min<uint64_t>(n, (end - p) / 2);
+  uint64_t narr = countArrayKeys(p, end, size);
+  lua_createtable(L, static_cast<int>(narr), static_cast<int>(size - narr));
+  if (refs_ != 0) addReference();
+  for (uint64_t i = 0; i < n; i++) {
+    p = decodeKey(p, end);
+    if (p == NULL) return NULL;
+    p = decodeObject(p, end); // value
+    if (p == NULL) return NULL;
+    lua_rawset(L, -3);
+  }
+  return p;
+}
+
+const char* Decoder::decodeProjectedTable(const char* p, const char* end,
+                                          uint64_t n,
+                                          const Projection* projection) {
+  if (!lua_checkstack(L, 3)) {
+    throw msgpack::unpack_error("too deeply nested");
+  }
+
+  uint64_t size = std::min<uint64_t>(n, projection->size());
+  lua_createtable(L, 0, static_cast<int>(size));
+  for (uint64_t i = 0; i < n; i++) {
+    // Only string keys are compared with the projection.
+    Header h;
+    if (!readHeader(p, end - p, &h)) return NULL;
+    const Projection::Field* f = NULL;
+    if (h.type == Header::RAW &&
+        static_cast<uint64_t>(end - p) - h.size >= h.value) {
+      f = projection->find(p + h.size, static_cast<size_t>(h.value));
+    } else if (isDictionaryKey(h)) {
+      lua_rawgeti(L, dict_, static_cast<int>(h.value));
+      size_t len;
+      const char* key = lua_tolstring(L, -1, &len);
+      f = projection->find(key, len);
+      lua_pop(L, 1);
+    }
+
+    if (f == NULL) {
+      p = skip(p, end); // key
+      if (p == NULL) return NULL;
+      p = skip(p, end); // value
+      if (p == NULL) return NULL;
+      continue;
+    }
+
+    p = decodeKey(p, end);
+    if (p == NULL) return NULL;
+    p = decodeObject(p, end, f->nested); // value
+    if (p == NULL) return NULL;
+    lua_rawset(L, -3);
+  }
+  return p;
+}
+
+const char* Decoder::decodeKey(const char* p, const char* end) {
+  if (dict_ != 0) {
+    Header h;
+    if (!readHeader(p, end - p, &h)) return NULL;
+    if (isDictionaryKey(h)) {
+      if (limits_ != NULL) limits_->check(h, depth_, &objects_);
+      lua_rawgeti(L, dict_, static_cast<int>(h.value));
+      return p + h.size;
+    }
+  }
+  return decodeObject(p, end);
+}
+
+bool Decoder::isDictionaryKey(const Header& h) const {
+  return dict_ != 0 && h.type == Header::UNSIGNED_INTEGER && h.value >= 1 &&
+    h.value <= dictionary_->size();
+}
+
+const char* Decoder::skip(const char* p, const char* end) {
+  Header h;
+  h.type = Header::NIL;
+  p = skipObject(p, end, &h);
+  if (p == NULL && h.type == Header::INVALID) {
+    throw msgpack::unpack_error("invalid type");
+  }
+  return p;
+}
+
+const char* Decoder::decodeExt(int8_t type, const char* p, size_t size) {
+  if (!lua_checkstack(L, 3)) {
+    throw msgpack::unpack_error("too deeply nested");
+  }
+
+  if (type == SharedReferences::EnvelopeExtType) {
+    return decodeShared(p, size);
+  }
+  if (type == SharedReferences::ReferenceExtType) {
+    if (refs_ == 0) {
+      throw msgpack::unpack_error("reference outside a shared object");
+    }
+    uint32_t id = SharedReferences::read(p, size);
+    if (id >= next_ref_) throw msgpack::unpack_error("invalid reference");
+    lua_rawgeti(L, refs_, static_cast<int>(id + 1));
+    return p + size;
+  }
+  if (type == ExtRegistry::ClassExtType) {
+    return decodeClass(p, size);
+  }
+  if (!NumericArray::unpack(L, type, p, size)) {
+    const ExtRegistry* ext = ExtRegistry::get(L);
+    if (ext == NULL || !ext->unpack(L, type, p, size)) {
+      throw msgpack::unpack_error("ext type is not supported");
+    }
+  }
+  return p + size;
+}
+
+const char* Decoder::decodeShared(const char* p, size_t size) {
+  int refs = refs_;
+  uint32_t next_ref = next_ref_;
+
+  lua_newtable(L);
+  refs_ = lua_gettop(L);
+  next_ref_ = 0;
+
+  // The payload is complete, so it has to be exactly one object.
+  const char* end = p + size;
+  if (decodeObject(p, end) != end) {
+    throw msgpack::unpack_error("malformed shared object");
+  }
+  lua_remove(L, refs_);
+
+  refs_ = refs;
+  next_ref_ = next_ref;
+  return end;
+}
+
+const char* Decoder::decodeClass(const char* p, size_t size) {
+  const char* end = p + size;
+  Header h;
+  if (!readHeader(p, size, &h) || h.type != Header::ARRAY || h.value == 0) {
+    throw msgpack::unpack_error("malformed class object");
+  }
+  if (limits_ != NULL) limits_->check(h, depth_, &objects_);
+  p += h.size;
+  if (!lua_checkstack(L, 4)) {
+    throw msgpack::unpack_error("too deeply nested");
+  }
+
+  // The table is numbered before the name, as LuaObjects numbers it
+  // before packing the name.
+  uint64_t n = h.value - 1;
+  lua_createtable(L, 0, static_cast<int>(std::min<uint64_t>(n, end - p)));
+  if (refs_ != 0) addReference();
+
+  p = decodeObject(p, end);
+  if (p == NULL || lua_type(L, -1) != LUA_TSTRING) {
+    throw msgpack::unpack_error("malformed class object");
+  }
+  size_t len;
+  const char* name = lua_tolstring(L, -1, &len);
+  const ExtRegistry* ext = ExtRegistry::get(L);
+  const ExtRegistry::Class* c =
+    ext != NULL ? ext->findClass(name, len) : NULL;
+  if (c == NULL) {
+    throw msgpack::unpack_error("class is not registered: " +
+                                std::string(name, len));
+  }
+  lua_pop(L, 1);
+
+  // The metatable is set before the fields so that a field referring to
+  // the table sees it. Values of fields the class does not have are
+  // dropped, and missing fields are left nil.
+  lua_rawgeti(L, LUA_REGISTRYINDEX, c->metatable_ref);
+  lua_setmetatable(L, -2);
+  lua_rawgeti(L, LUA_REGISTRYINDEX, c->fields_ref);
+  uint64_t nfields = c->size; // c may be invalidated by decoders
+  depth_++;
+  for (uint64_t i = 0; i < n; i++) {
+    p = decodeObject(p, end);
+    if (p == NULL) throw msgpack::unpack_error("malformed class object");
+    if (i < nfields) {
+      lua_rawgeti(L, -2, static_cast<int>(i + 2));
+      lua_insert(L, -2);
+      lua_rawset(L, -4);
+    } else {
+      lua_pop(L, 1);
+    }
+  }
+  depth_--;
+  if (p != end) throw msgpack::unpack_error("malformed class object");
+  lua_pop(L, 1); // the fields
+  return end;
+}
+
+void Decoder::addReference() {
+  lua_pushvalue(L, -1);
+  lua_rawseti(L, refs_, static_cast<int>(++next_ref_));
+}
+
+uint64_t Decoder::countArrayKeys(const char* p, const char* end, uint64_t n) {
+  // LuaObjects packs a table having both the array part and the hash part
+  // as a map whose keys begin with 1, 2, ..., so only leading keys are
+  // counted. Keys after the lookahead are stored in the hash part.
+  n = std::min(n, MaxArrayKeyLookahead);
+  uint64_t i;
+  for (i = 0; i < n; i++) {
+    Header h;
+    if (!readHeader(p, end - p, &h)) break;
+
+    // With a Dictionary, integral keys up to its size are packed as
+    // doubles since positions in it are packed as integers.
+    bool array_key = false;
+    if (h.type == Header::UNSIGNED_INTEGER) {
+      array_key = h.value == i + 1 && !isDictionaryKey(h);
+    } else if (h.type == Header::DOUBLE) {
+      double d;
+      memcpy(&d, &h.value, sizeof(d));
+      array_key = d == static_cast<double>(i + 1);
+    }
+    if (!array_key) break;
+    p = skipObject(p + h.size, end, &h); // value
+    if (p == NULL) break;
+  }
+  return i;
+}
+
+} // namespace lua
+} // namespace msgpack
@@ -0,0 +1,161 @@
+/*
+ * MessagePack for Lua
+ *
+ * Copyright (C) 2010 Nobuyuki Kubota
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef MSGPACK_LUA_DECODER_HPP_
+#define MSGPACK_LUA_DECODER_HPP_
+
+#include <lua.hpp>
+#include <msgpack.hpp>
+
+namespace msgpack {
+namespace lua {
+
+class Dictionary;
+class Limits;
+class Projection;
+struct Header;
+
+/**
+ * @brief Deserializer which builds Lua values directly from serialized data.
+ *
+ * Unlike LuaObjects::msgpack_unpack, this does not build msgpack::object
+ * before building Lua values.
+ *
+ * References of SharedReferences are resolved to the values deserialized
+ * before them. A projection meeting an object having references is an
+ * error, since skipped values would not be numbered.
+ */
+class Decoder {
+public:
+  /**
+   * @param projection Keys of maps to be deserialized, or NULL to
+   * deserialize all keys. The projection is applied to the map at the top
+   * level, or to maps reached from it only through arrays.
+   * @param limits Limits checked before deserializing each object, or
+   * NULL.
+   * @param dictionary The Dictionary used for map keys, or NULL. The
+   * Dictionary has to be kept alive while the Decoder is used.
+   */
+  explicit Decoder(lua_State* L, const Projection* projection = NULL,
+                   const Limits* limits = NULL,
+                   const Dictionary* dictionary = NULL);
+
+  /**
+   * @brief Deserializes an object at the beginning of data and pushes it
+   * onto the stack.
+   *
+   * @return The size of the deserialized object. If data does not have the
+   * complete object, returns 0 and pushes nothing.
+   *
+   * @throw msgpack::unpack_error when data is malformed.
+   */
+  size_t decode(const char* data, size_t size);
+
+private:
+  /**
+   * @return The end of the deserialized object, or NULL if the object is
+   * not complete.
+   */
+  const char* decodeObject(const char* p, const char* end,
+                           const Projection* projection = NULL);
+  const char* decodeArray(const char* p, const char* end, uint64_t n,
+                          const Projection* projection);
+  const char* decodeTable(const char* p, const char* end, uint64_t n);
+
+  /**
+   * @brief Deserializes a map key, which may be a position in the
+   * Dictionary.
+   */
+  const char* decodeKey(const char* p, const char* end);
+
+  /**
+   * @brief Returns true if the header is of a position in the Dictionary.
+   */
+  bool isDictionaryKey(const Header& h) const;
+
+  /**
+   * @brief Deserializes a map having n entries, skipping entries whose
+   * keys are not in the projection.
+   */
+  const char* decodeProjectedTable(const char* p, const char* end,
+                                   uint64_t n, const Projection* projection);
+
+  /**
+   * @brief Skips an object at p.
+   *
+   * @return The end of the object, or NULL if the object is not complete.
+   */
+  const char* skip(const char* p, const char* end);
+
+  /**
+   * @brief Returns the number of keys to be stored in the array part of
+   * the table deserialized from a map having n entries.
+   *
+   * Only a bounded number of leading entries are looked at. Positions in
+   * the Dictionary are not counted as array keys.
+   */
+  uint64_t countArrayKeys(const char* p, const char* end, uint64_t n);
+
+  /**
+   * @brief Deserializes the payload of an ext object.
+   */
+  const char* decodeExt(int8_t type, const char* p, size_t size);
+
+  /**
+   * @brief Deserializes a table of a class registered in ExtRegistry.
+   */
+  const char* decodeClass(const char* p, size_t size);
+
+  /**
+   * @brief Deserializes an object having references.
+   */
+  const char* decodeShared(const char* p, size_t size);
+
+  /**
+   * @brief Numbers the value on the top of the stack so that references
+   * are resolved to it.
+   */
+  void addReference();
+
+private:
+  lua_State* L;
+  const Projection* projection_;
+  const Limits* limits_;
+  const Dictionary* dictionary_;
+
+  // The number of arrays and maps containing the object being
+  // deserialized, and the number of objects deserialized in the top-level
+  // object. These are used to check limits.
+  size_t depth_;
+  size_t objects_;
+
+  // The index of the table having values referred by references while an
+  // object having references is deserialized, or 0, and the number of
+  // values in it.
+  int refs_;
+  uint32_t next_ref_;
+
+  // The index of the table of the Dictionary while an object is
+  // deserialized, or 0.
+  int dict_;
+};
+
+} // namespace lua
+} // namespace msgpack
+
+#endif
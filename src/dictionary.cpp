@@ -0,0 +1,111 @@
+/*
+ * MessagePack for Lua
+ *
+ * Copyright (C) 2010 Nobuyuki Kubota
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "dictionary.hpp"
+
+namespace msgpack {
+namespace lua {
+
+const char* const Dictionary::MetatableName = "msgpack.Dictionary";
+
+void Dictionary::registerUserdata(lua_State* L) {
+  if (luaL_newmetatable(L, Dictionary::MetatableName) == 0) {
+    lua_pop(L, 1);
+    return; // already created
+  }
+
+  // set __gc
+  lua_pushcfunction(L, &Dictionary::finalizer);
+  lua_setfield(L, -2, "__gc");
+  lua_pop(L, 1);
+}
+
+int Dictionary::create(lua_State* L) {
+  luaL_checktype(L, 1, LUA_TTABLE);
+  lua_settop(L, 1);
+
+  // The userdata is created first so that the Dictionary is deleted by
+  // __gc even if a key is invalid.
+  Dictionary** p =
+    static_cast<Dictionary**>(lua_newuserdata(L, sizeof(Dictionary*)));
+  luaL_getmetatable(L, Dictionary::MetatableName);
+  lua_setmetatable(L, -2);
+  *p = new Dictionary();
+  Dictionary* d = *p;
+
+  size_t n = lua_objlen(L, 1);
+  lua_createtable(L, static_cast<int>(n), static_cast<int>(n)); // keys: 3
+  for (size_t i = 1; i <= n; i++) {
+    lua_rawgeti(L, 1, static_cast<int>(i));
+    if (lua_type(L, -1) != LUA_TSTRING) {
+      return luaL_error(L, "dictionary keys must be strings");
+    }
+    lua_pushvalue(L, -1);
+    lua_rawget(L, 3);
+    if (!lua_isnil(L, -1)) {
+      return luaL_error(L, "duplicate key in dictionary: %s",
+                        lua_tostring(L, -2));
+    }
+    lua_pop(L, 1);
+
+    lua_pushvalue(L, -1);
+    lua_rawseti(L, 3, static_cast<int>(i)); // keys[i] = key
+    lua_pushnumber(L, static_cast<lua_Number>(i));
+    lua_rawset(L, 3); // keys[key] = i
+  }
+
+  d->size_ = n;
+  d->ref_ = luaL_ref(L, LUA_REGISTRYINDEX);
+  return 1;
+}
+
+Dictionary* Dictionary::toDictionary(lua_State* L, int index) {
+  if (!lua_getmetatable(L, index)) return NULL;
+  luaL_getmetatable(L, Dictionary::MetatableName);
+  bool is_dictionary = lua_rawequal(L, -1, -2) != 0;
+  lua_pop(L, 2);
+  if (!is_dictionary) return NULL;
+  return *static_cast<Dictionary**>(lua_touserdata(L, index));
+}
+
+Dictionary* Dictionary::getOption(lua_State* L, int options) {
+  lua_getfield(L, options, "dictionary");
+  if (lua_isnil(L, -1)) {
+    lua_pop(L, 1);
+    return NULL;
+  }
+
+  Dictionary* d = toDictionary(L, -1);
+  if (d == NULL) luaL_error(L, "option 'dictionary' must be a Dictionary");
+  lua_pop(L, 1);
+  return d;
+}
+
+int Dictionary::finalizer(lua_State* L) {
+  Dictionary* d = *static_cast<Dictionary**>(
+    luaL_checkudata(L, 1, Dictionary::MetatableName));
+  luaL_unref(L, LUA_REGISTRYINDEX, d->ref_);
+  delete d;
+  return 0;
+}
+
+Dictionary::Dictionary() : ref_(LUA_NOREF), size_(0) {
+}
+
+} // namespace lua
+} // namespace msgpack
@@ -0,0 +1,97 @@
+/*
+ * MessagePack for Lua
+ *
+ * Copyright (C) 2010 Nobuyuki Kubota
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef MSGPACK_LUA_DICTIONARY_HPP_
+#define MSGPACK_LUA_DICTIONARY_HPP_
+
+#include <lua.hpp>
+
+namespace msgpack {
+namespace lua {
+
+/**
+ * @brief Map keys shared by a packer and an unpacker in advance.
+ *
+ * Usage:
+ * d = msgpack.Dictionary{"timestamp", "user_id", ...}
+ * data = msgpack.pack(record, d)
+ * record = msgpack.unpack(data, d)
+ * p = msgpack.Packer{dictionary = d}
+ * u = msgpack.Unpacker{dictionary = d}
+ *
+ * A string map key in the dictionary is packed as its position in the
+ * dictionary, which is a positive integer. An integral map key within
+ * the positions is packed as a double so that it is not confused with a
+ * dictionary key. Keys are unpacked into the strings anchored by the
+ * dictionary, so they are not interned again.
+ */
+class Dictionary {
+private:
+  Dictionary(const Dictionary&);
+  Dictionary& operator =(const Dictionary&);
+
+public:
+  static const char* const MetatableName;
+  static void registerUserdata(lua_State* L);
+
+  /**
+   * @brief Creates a Dictionary of the strings in the array given as the
+   * 1st argument.
+   */
+  static int create(lua_State* L);
+
+  /**
+   * @brief Returns the Dictionary at the given index, or NULL if the
+   * value is not a Dictionary.
+   */
+  static Dictionary* toDictionary(lua_State* L, int index);
+
+  /**
+   * @brief Returns the Dictionary of the field 'dictionary' of the options
+   * table at the given index, or NULL if the field is nil.
+   */
+  static Dictionary* getOption(lua_State* L, int options);
+
+private:
+  static int finalizer(lua_State* L);
+
+public:
+  Dictionary();
+
+  /**
+   * @brief Returns the number of keys.
+   */
+  size_t size() const { return size_; }
+
+  /**
+   * @brief Pushes the table having the keys at 1, 2, ..., and their
+   * positions at the keys.
+   */
+  void push(lua_State* L) const {
+    lua_rawgeti(L, LUA_REGISTRYINDEX, ref_);
+  }
+
+private:
+  int ref_;
+  size_t size_;
+};
+
+} // namespace lua
+} // namespace msgpack
+
+#endif
@@ -0,0 +1,281 @@
+/*
+ * MessagePack for Lua
+ *
+ * Copyright (C) 2010 Nobuyuki Kubota
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "ext_registry.hpp"
+
+
+namespace msgpack {
+namespace lua {
+namespace {
+// The address is the key of the ExtRegistry in the registry.
+char RegistryKey;
+} // namespace
+
+const char* const ExtRegistry::MetatableName = "msgpack.ExtRegistry";
+
+void ExtRegistry::registerUserdata(lua_State* L) {
+  if (luaL_newmetatable(L, ExtRegistry::MetatableName) == 0) {
+    lua_pop(L, 1);
+    return; // already created
+  }
+
+  // set __gc
+  lua_pushcfunction(L, &ExtRegistry::finalizer);
+  lua_setfield(L, -2, "__gc");
+  lua_pop(L, 1);
+}
+
+int ExtRegistry::registerExt(lua_State* L) {
+  lua_Integer type = luaL_checkinteger(L, 1);
+  luaL_argcheck(L, type >= 0 && type <= 127 &&
+                !reserved(static_cast<int8_t>(type)), 1, "invalid ext type");
+  luaL_checktype(L, 2, LUA_TTABLE);
+  luaL_checktype(L, 3, LUA_TFUNCTION);
+  if (!lua_isnoneornil(L, 4)) luaL_checktype(L, 4, LUA_TFUNCTION);
+
+  Codec c;
+  c.metatable = lua_topointer(L, 2);
+  c.type = static_cast<int8_t>(type);
+  lua_pushvalue(L, 2);
+  c.metatable_ref = luaL_ref(L, LUA_REGISTRYINDEX);
+  lua_pushvalue(L, 3);
+  c.encode_ref = luaL_ref(L, LUA_REGISTRYINDEX);
+  c.decode_ref = LUA_NOREF;
+  if (!lua_isnoneornil(L, 4)) {
+    lua_pushvalue(L, 4);
+    c.decode_ref = luaL_ref(L, LUA_REGISTRYINDEX);
+  }
+  c.encode = NULL;
+  c.decode = NULL;
+  getOrCreate(L)->add(L, c);
+  return 0;
+}
+
+int ExtRegistry::registerClass(lua_State* L) {
+  size_t len;
+  const char* name = luaL_checklstring(L, 1, &len);
+  luaL_checktype(L, 2, LUA_TTABLE);
+  luaL_checktype(L, 3, LUA_TTABLE);
+
+  // Field names are copied so that later changes to the list do not
+  // change the format.
+  size_t n = lua_objlen(L, 3);
+  lua_createtable(L, static_cast<int>(n + 1), 0);
+  lua_pushvalue(L, 1);
+  lua_rawseti(L, -2, 1);
+  for (size_t i = 1; i <= n; i++) {
+    lua_rawgeti(L, 3, static_cast<int>(i));
+    if (lua_type(L, -1) != LUA_TSTRING) {
+      return luaL_error(L, "field names must be strings");
+    }
+    lua_rawseti(L, -2, static_cast<int>(i + 1));
+  }
+
+  Class c;
+  c.metatable = lua_topointer(L, 2);
+  c.name.assign(name, len);
+  c.fields_ref = luaL_ref(L, LUA_REGISTRYINDEX);
+  lua_pushvalue(L, 2);
+  c.metatable_ref = luaL_ref(L, LUA_REGISTRYINDEX);
+  c.size = n;
+  getOrCreate(L)->addClass(L, c);
+  return 0;
+}
+
+void ExtRegistry::registerCodec(lua_State* L, int8_t type, int metatable,
+                                ExtEncoder encode, ExtDecoder decode) {
+  Codec c;
+  c.metatable = lua_topointer(L, metatable);
+  c.type = type;
+  lua_pushvalue(L, metatable);
+  c.metatable_ref = luaL_ref(L, LUA_REGISTRYINDEX);
+  c.encode_ref = LUA_NOREF;
+  c.decode_ref = LUA_NOREF;
+  c.encode = encode;
+  c.decode = decode;
+  getOrCreate(L)->add(L, c);
+}
+
+ExtRegistry* ExtRegistry::get(lua_State* L) {
+  lua_pushlightuserdata(L, &RegistryKey);
+  lua_rawget(L, LUA_REGISTRYINDEX);
+  ExtRegistry* r = NULL;
+  if (!lua_isnil(L, -1)) {
+    r = *static_cast<ExtRegistry**>(lua_touserdata(L, -1));
+  }
+  lua_pop(L, 1);
+  return r;
+}
+
+ExtRegistry* ExtRegistry::getOrCreate(lua_State* L) {
+  ExtRegistry* r = get(L);
+  if (r != NULL) return r;
+
+  ExtRegistry** p =
+    static_cast<ExtRegistry**>(lua_newuserdata(L, sizeof(ExtRegistry*)));
+  luaL_getmetatable(L, ExtRegistry::MetatableName);
+  lua_setmetatable(L, -2);
+  *p = new ExtRegistry();
+
+  lua_pushlightuserdata(L, &RegistryKey);
+  lua_pushvalue(L, -2);
+  lua_rawset(L, LUA_REGISTRYINDEX);
+  lua_pop(L, 1);
+  return *p;
+}
+
+int ExtRegistry::finalizer(lua_State* L) {
+  ExtRegistry* r = *static_cast<ExtRegistry**>(
+    luaL_checkudata(L, 1, ExtRegistry::MetatableName));
+  delete r;
+  return 0;
+}
+
+ExtRegistry::ExtRegistry() : last_(0), last_class_(0) {
+  for (int i = 0; i < 256; i++) decoders_[i] = -1;
+}
+
+bool ExtRegistry::pack(lua_State* L, int index, BufferPacker& pk) const {
+  if (!lua_getmetatable(L, index)) return false;
+  const Codec* c = find(lua_topointer(L, -1));
+  lua_pop(L, 1);
+  if (c == NULL) return false;
+
+  // The codec is copied since the encoder may register codecs.
+  Codec codec = *c;
+  size_t header = pk.reserveExtHeader();
+  if (codec.encode != NULL) {
+    codec.encode(L, index, pk.buffer());
+  } else {
+    if (index < 0) index = lua_gettop(L) + index + 1;
+    lua_rawgeti(L, LUA_REGISTRYINDEX, codec.encode_ref);
+    lua_pushvalue(L, index);
+    if (lua_pcall(L, 1, 1, 0) != 0) throwPackError(L);
+    if (lua_type(L, -1) != LUA_TSTRING) {
+      throwPackError(L, "ext encoder must return a string");
+    }
+    size_t len;
+    const char* payload = lua_tolstring(L, -1, &len);
+    pk.buffer().write(payload, len);
+    lua_pop(L, 1);
+  }
+  pk.fixExtHeader(header, codec.type);
+  return true;
+}
+
+bool ExtRegistry::unpack(lua_State* L, int8_t type, const char* payload,
+                         size_t size) const {
+  int i = decoders_[type + 128];
+  if (i < 0) return false;
+
+  const Codec& c = codecs_[i];
+  if (c.decode != NULL) {
+    c.decode(L, payload, size);
+    return true;
+  }
+  lua_rawgeti(L, LUA_REGISTRYINDEX, c.decode_ref);
+  lua_pushlstring(L, payload, size);
+  if (lua_pcall(L, 1, 1, 0) != 0) {
+    const char* s = lua_tostring(L, -1);
+    std::string message = s != NULL ? s : "(error object is not a string)";
+    lua_pop(L, 1);
+    throw msgpack::unpack_error(message);
+  }
+  return true;
+}
+
+const ExtRegistry::Class* ExtRegistry::findClass(lua_State* L,
+                                                 int index) const {
+  if (classes_.empty() || !lua_getmetatable(L, index)) return NULL;
+  const void* metatable = lua_topointer(L, -1);
+  lua_pop(L, 1);
+
+  if (last_class_ < classes_.size() &&
+      classes_[last_class_].metatable == metatable) {
+    return &classes_[last_class_];
+  }
+  for (size_t i = 0; i < classes_.size(); i++) {
+    if (classes_[i].metatable == metatable) {
+      last_class_ = i;
+      return &classes_[i];
+    }
+  }
+  return NULL;
+}
+
+const ExtRegistry::Class* ExtRegistry::findClass(const char* name,
+                                                 size_t len) const {
+  std::map<std::string, size_t>::const_iterator it =
+    class_names_.find(std::string(name, len));
+  return it != class_names_.end() ? &classes_[it->second] : NULL;
+}
+
+void ExtRegistry::add(lua_State* L, const Codec& codec) {
+  for (size_t i = codecs_.size(); i > 0; i--) {
+    Codec& c = codecs_[i - 1];
+    if (c.metatable != codec.metatable && c.type != codec.type) continue;
+    luaL_unref(L, LUA_REGISTRYINDEX, c.metatable_ref);
+    luaL_unref(L, LUA_REGISTRYINDEX, c.encode_ref);
+    luaL_unref(L, LUA_REGISTRYINDEX, c.decode_ref);
+    codecs_.erase(codecs_.begin() + (i - 1));
+  }
+  codecs_.push_back(codec);
+
+  for (int i = 0; i < 256; i++) decoders_[i] = -1;
+  for (size_t i = 0; i < codecs_.size(); i++) {
+    const Codec& c = codecs_[i];
+    if (c.decode != NULL || c.decode_ref != LUA_NOREF) {
+      decoders_[c.type + 128] = static_cast<int>(i);
+    }
+  }
+  last_ = 0;
+}
+
+const ExtRegistry::Codec* ExtRegistry::find(const void* metatable) const {
+  if (last_ < codecs_.size() && codecs_[last_].metatable == metatable) {
+    return &codecs_[last_];
+  }
+  for (size_t i = 0; i < codecs_.size(); i++) {
+    if (codecs_[i].metatable == metatable) {
+      last_ = i;
+      return &codecs_[i];
+    }
+  }
+  return NULL;
+}
+
+void ExtRegistry::addClass(lua_State* L, const Class& c) {
+  for (size_t i = classes_.size(); i > 0; i--) {
+    Class& old = classes_[i - 1];
+    if (old.metatable != c.metatable && old.name != c.name) continue;
+    luaL_unref(L, LUA_REGISTRYINDEX, old.metatable_ref);
+    luaL_unref(L, LUA_REGISTRYINDEX, old.fields_ref);
+    classes_.erase(classes_.begin() + (i - 1));
+  }
+  classes_.push_back(c);
+  last_class_ = 0;
+
+  // Indices after an erased class have changed.
+  class_names_.clear();
+  for (size_t i = 0; i < classes_.size(); i++) {
+    class_names_[classes_[i].name] = i;
+  }
+}
+
+} // namespace lua
+} // namespace msgpack
@@ -0,0 +1,221 @@
+/*
+ * MessagePack for Lua
+ *
+ * Copyright (C) 2010 Nobuyuki Kubota
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef MSGPACK_LUA_EXT_REGISTRY_HPP_
+#define MSGPACK_LUA_EXT_REGISTRY_HPP_
+
+#include <map>
+#include <string>
+#include <vector>
+#include <lua.hpp>
+#include <msgpack.hpp>
+#include "buffer_packer.hpp"
+#include "pack_error.hpp"
+
+namespace msgpack {
+namespace lua {
+
+/**
+ * @brief Appends the payload of the ext object for the value at the given
+ * index.
+ *
+ * @throw PackError when the value cannot be packed. An encoder must not
+ * raise a Lua error, which would skip releasing the output buffer.
+ */
+typedef void (*ExtEncoder)(lua_State* L, int index, msgpack::sbuffer& buffer);
+
+/**
+ * @brief Pushes the value deserialized from the payload of an ext object.
+ *
+ * @throw msgpack::unpack_error when the payload is malformed.
+ */
+typedef void (*ExtDecoder)(lua_State* L, const char* payload, size_t size);
+
+/**
+ * @brief Codecs packing values of given metatables as ext objects.
+ *
+ * Usage:
+ * msgpack.registerExt(type, metatable, encode [, decode])
+ *
+ * A userdata or a table whose metatable is registered is packed as an ext
+ * object of the type, whose payload is the string returned by
+ * encode(value). An ext object of the type is unpacked as
+ * decode(payload). Codecs can also be registered from C++ by
+ * registerCodec.
+ *
+ * Codecs are looked up by the pointer of the metatable, and the last
+ * codec found is cached, so packing does not look up fields of the
+ * metatable. Types from 16 to 47 are reserved by this library, and
+ * negative types, which are reserved by the MessagePack specification,
+ * can be registered only by registerCodec.
+ *
+ * Classes of tables are registered as well:
+ * msgpack.registerClass(name, metatable, {"field1", "field2", ...})
+ *
+ * A table whose metatable is registered as a class is packed as an ext
+ * object of ClassExtType, whose payload is an array of the name and the
+ * values of the fields in the order of registration. The table is
+ * unpacked with the metatable of the class of the name. Fields unknown to
+ * the class are not packed. Fields are read by rawget, so a default given
+ * by __index of the metatable is not packed, and is seen again through
+ * the metatable of the unpacked table.
+ */
+class ExtRegistry {
+private:
+  ExtRegistry(const ExtRegistry&);
+  ExtRegistry& operator =(const ExtRegistry&);
+
+public:
+  static const char* const MetatableName;
+  static void registerUserdata(lua_State* L);
+
+  /**
+   * @brief registerExt function which is provided as a module function.
+   */
+  static int registerExt(lua_State* L);
+
+  /**
+   * @brief Registers a codec implemented in C++ for the metatable at the
+   * given index.
+   *
+   * decode can be NULL if values are only packed.
+   */
+  static void registerCodec(lua_State* L, int8_t type, int metatable,
+                            ExtEncoder encode, ExtDecoder decode);
+
+  /**
+   * @brief Returns the ExtRegistry of the lua_State, or NULL if no codec
+   * has been registered.
+   */
+  static ExtRegistry* get(lua_State* L);
+
+  /**
+   * @brief registerClass function which is provided as a module function.
+   */
+  static int registerClass(lua_State* L);
+
+  static bool reserved(int8_t type) { return type >= 16 && type <= 47; }
+
+  static const int8_t ClassExtType = 0x22;
+
+  struct Class {
+    const void* metatable;
+    std::string name;
+
+    // references to the metatable and the table having the name at 1 and
+    // field names at 2, 3, ...
+    int metatable_ref;
+    int fields_ref;
+
+    // the number of fields
+    size_t size;
+  };
+
+private:
+  static ExtRegistry* getOrCreate(lua_State* L);
+  static int finalizer(lua_State* L);
+
+public:
+  ExtRegistry();
+
+  /**
+   * @brief Packs the value at the given index as an ext object if its
+   * metatable is registered.
+   *
+   * An error raised by the encoder function is thrown as a PackError.
+   *
+   * @return false if the value has not been packed.
+   */
+  bool pack(lua_State* L, int index, BufferPacker& pk) const;
+
+  /**
+   * @brief Pushes the value deserialized from an ext object.
+   *
+   * An error raised by the decoder function is thrown as
+   * msgpack::unpack_error.
+   *
+   * @return false if the type is not registered.
+   */
+  bool unpack(lua_State* L, int8_t type, const char* payload,
+              size_t size) const;
+
+  /**
+   * @brief Returns the class of the metatable of the table at the given
+   * index, or NULL.
+   */
+  const Class* findClass(lua_State* L, int index) const;
+
+  /**
+   * @brief Returns the class of the name, or NULL.
+   */
+  const Class* findClass(const char* name, size_t len) const;
+
+private:
+  struct Codec {
+    const void* metatable;
+    int8_t type;
+
+    // references to the metatable and Lua functions in the registry
+    int metatable_ref;
+    int encode_ref;
+    int decode_ref;
+
+    // functions in C++, used when they are not NULL
+    ExtEncoder encode;
+    ExtDecoder decode;
+  };
+
+  /**
+   * @brief Adds the codec, replacing those of the same metatable or the
+   * same type.
+   */
+  void add(lua_State* L, const Codec& codec);
+
+  /**
+   * @brief Returns the codec of the metatable, or NULL.
+   */
+  const Codec* find(const void* metatable) const;
+
+  /**
+   * @brief Adds the class, replacing those of the same metatable or the
+   * same name.
+   */
+  void addClass(lua_State* L, const Class& c);
+
+private:
+  std::vector<Codec> codecs_;
+
+  // indices of codecs_ by type + 128, or -1
+  int decoders_[256];
+
+  // the index of the codec found last
+  mutable size_t last_;
+
+  std::vector<Class> classes_;
+
+  // indices of classes_ by name
+  std::map<std::string, size_t> class_names_;
+
+  // the index of the class found last by its metatable
+  mutable size_t last_class_;
+};
+
+} // namespace lua
+} // namespace msgpack
+
+#endif
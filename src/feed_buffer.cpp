@@ -0,0 +1,121 @@
+/*
+ * MessagePack for Lua
+ *
+ * Copyright (C) 2010 Nobuyuki Kubota
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "feed_buffer.hpp"
+
+#include <algorithm>
+
+namespace msgpack {
+namespace lua {
+
+const size_t FeedBuffer::MinBridgeSize;
+const size_t FeedBuffer::DefaultRetainSize;
+
+FeedBuffer::FeedBuffer(size_t retain_size)
+  : offset_(0), bridge_offset_(0), retain_size_(retain_size),
+    total_size_(0) {
+}
+
+void FeedBuffer::append(lua_State* L, int index) {
+  Chunk c;
+  c.data = lua_tolstring(L, index, &c.size);
+  if (c.size == 0) return;
+
+  lua_pushvalue(L, index);
+  c.ref = luaL_ref(L, LUA_REGISTRYINDEX);
+  chunks_.push_back(c);
+  total_size_ += c.size;
+}
+
+const char* FeedBuffer::data() const {
+  if (bridging()) return &bridge_[bridge_offset_];
+  if (chunks_.empty()) return NULL;
+  return chunks_.front().data + offset_;
+}
+
+size_t FeedBuffer::size() const {
+  if (bridging()) return bridge_.size() - bridge_offset_;
+  if (chunks_.empty()) return 0;
+  return chunks_.front().size - offset_;
+}
+
+bool FeedBuffer::pushSource(lua_State* L) const {
+  if (bridging() || chunks_.empty()) return false;
+  lua_rawgeti(L, LUA_REGISTRYINDEX, chunks_.front().ref);
+  return true;
+}
+
+bool FeedBuffer::extend(lua_State* L) {
+  shift(L);
+  if (!bridging()) {
+    // Move the rest of the first chunk into the bridge.
+    if (chunks_.size() < 2) return false;
+    const Chunk& c = chunks_.front();
+    bridge_.assign(c.data + offset_, c.data + c.size);
+    bridge_offset_ = 0;
+    popChunk(L);
+  }
+  if (chunks_.empty()) return false;
+
+  // The bridge grows at least twice as large so that an object lying
+  // across many chunks is copied in amortized linear time.
+  const Chunk& c = chunks_.front();
+  size_t n = std::max(bridge_.size() - bridge_offset_, MinBridgeSize);
+  n = std::min(n, c.size - offset_);
+  bridge_.insert(bridge_.end(), c.data + offset_, c.data + offset_ + n);
+  offset_ += n;
+  shift(L);
+  return true;
+}
+
+void FeedBuffer::consume(size_t size) {
+  if (bridging()) bridge_offset_ += size;
+  else offset_ += size;
+  total_size_ -= size;
+}
+
+void FeedBuffer::shift(lua_State* L) {
+  if (!bridge_.empty() && !bridging()) resetBridge();
+  while (!chunks_.empty() && offset_ == chunks_.front().size) {
+    popChunk(L);
+  }
+}
+
+void FeedBuffer::clear(lua_State* L) {
+  while (!chunks_.empty()) popChunk(L);
+  resetBridge();
+  total_size_ = 0;
+}
+
+void FeedBuffer::resetBridge() {
+  if (bridge_.capacity() > retain_size_) {
+    std::vector<char>().swap(bridge_);
+  } else {
+    bridge_.clear();
+  }
+  bridge_offset_ = 0;
+}
+
+void FeedBuffer::popChunk(lua_State* L) {
+  luaL_unref(L, LUA_REGISTRYINDEX, chunks_.front().ref);
+  chunks_.pop_front();
+  offset_ = 0;
+}
+
+} // namespace lua
+} // namespace msgpack
@@ -0,0 +1,141 @@
+/*
+ * MessagePack for Lua
+ *
+ * Copyright (C) 2010 Nobuyuki Kubota
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef MSGPACK_LUA_FEED_BUFFER_HPP_
+#define MSGPACK_LUA_FEED_BUFFER_HPP_
+
+#include <deque>
+#include <vector>
+#include <lua.hpp>
+
+namespace msgpack {
+namespace lua {
+
+/**
+ * @brief Buffer of fed data which refers to Lua strings instead of
+ * copying them.
+ *
+ * Fed strings are kept in the registry until they are consumed. Objects
+ * in a string are deserialized directly from the string. Only an object
+ * lying across two strings is copied into the bridge, an internal buffer
+ * which makes the object contiguous in memory.
+ */
+class FeedBuffer {
+private:
+  FeedBuffer(const FeedBuffer&);
+  FeedBuffer& operator =(const FeedBuffer&);
+
+public:
+  static const size_t DefaultRetainSize = 1024 * 1024;
+
+  /**
+   * @param retain_size The maximum capacity of the bridge kept after it
+   * is consumed.
+   */
+  explicit FeedBuffer(size_t retain_size = DefaultRetainSize);
+
+  /**
+   * @brief Appends the string at the given index.
+   */
+  void append(lua_State* L, int index);
+
+  /**
+   * @brief Returns the beginning of data not consumed yet.
+   *
+   * Data returned by this function is contiguous in memory, but may not
+   * contain all data in the buffer. See extend.
+   */
+  const char* data() const;
+
+  /**
+   * @brief Returns the size of data returned by data().
+   */
+  size_t size() const;
+
+  /**
+   * @brief Returns the size of all data not consumed yet.
+   */
+  size_t totalSize() const { return total_size_; }
+
+  /**
+   * @brief Pushes the string containing data() onto the stack.
+   *
+   * @return false when data() is in the bridge, which is not a Lua string.
+   * Nothing is pushed in that case.
+   */
+  bool pushSource(lua_State* L) const;
+
+  /**
+   * @brief Makes more data available from data().
+   *
+   * @return false when the buffer has no more data.
+   */
+  bool extend(lua_State* L);
+
+  /**
+   * @brief Consumes data from the beginning.
+   *
+   * Data remains valid until shift or clear is called.
+   */
+  void consume(size_t size);
+
+  /**
+   * @brief Releases consumed data.
+   */
+  void shift(lua_State* L);
+
+  /**
+   * @brief Releases all data.
+   */
+  void clear(lua_State* L);
+
+private:
+  bool bridging() const { return bridge_offset_ < bridge_.size(); }
+  void popChunk(lua_State* L);
+
+  /**
+   * @brief Empties the bridge, freeing it when it has grown beyond
+   * retain_size_ so that a huge object does not pin memory.
+   */
+  void resetBridge();
+
+private:
+  struct Chunk {
+    const char* data;
+    size_t size;
+    int ref; // reference to the string in the registry
+  };
+
+  // The minimum number of bytes moved into the bridge at once.
+  static const size_t MinBridgeSize = 4096;
+
+  std::deque<Chunk> chunks_;
+  size_t offset_; // consumed or bridged bytes in the first chunk
+
+  // Data in the bridge precedes data in chunks_.
+  std::vector<char> bridge_;
+  size_t bridge_offset_;
+  size_t retain_size_;
+
+  size_t total_size_;
+};
+
+} // namespace lua
+} // namespace msgpack
+
+#endif
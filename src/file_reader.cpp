@@ -0,0 +1,180 @@
+/*
+ * MessagePack for Lua
+ *
+ * Copyright (C) 2010 Nobuyuki Kubota
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "file_reader.hpp"
+
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "decoder.hpp"
+
+namespace msgpack {
+namespace lua {
+namespace {
+template<int (FileReader::*Memfun)(lua_State*)>
+int fileReaderProxy(lua_State* L) {
+  FileReader* r = *static_cast<FileReader**>(
+    luaL_checkudata(L, 1, FileReader::MetatableName));
+  return (r->*Memfun)(L);
+}
+
+int pushError(lua_State* L, const char* path, int err) {
+  lua_pushnil(L);
+  lua_pushfstring(L, "%s: %s", path, strerror(err));
+  return 2;
+}
+} // namespace
+
+const char* const FileReader::MetatableName = "msgpack.FileReader";
+
+void FileReader::registerUserdata(lua_State* L) {
+  if (luaL_newmetatable(L, FileReader::MetatableName) == 0) {
+    lua_pop(L, 1);
+    return; // already created
+  }
+
+  // metatable.__index = metatable
+  lua_pushvalue(L, -1);
+  lua_setfield(L, -2, "__index");
+
+  // set __gc
+  lua_pushcfunction(L, &FileReader::finalizer);
+  lua_setfield(L, -2, "__gc");
+
+  // set __call
+  lua_pushcfunction(L, &fileReaderProxy<&FileReader::next>);
+  lua_setfield(L, -2, "__call");
+
+  // register methods
+  const struct luaL_Reg Methods[] = {
+    {"next", &fileReaderProxy<&FileReader::next>},
+    {"seek", &fileReaderProxy<&FileReader::seek>},
+    {"tell", &fileReaderProxy<&FileReader::tell>},
+    {"close", &fileReaderProxy<&FileReader::close>},
+    {NULL, NULL}
+  };
+  luaL_register(L, NULL, Methods);
+  lua_pop(L, 1);
+}
+
+int FileReader::create(lua_State* L) {
+  const char* path = luaL_checkstring(L, 1);
+
+  int fd = open(path, O_RDONLY);
+  if (fd < 0) return pushError(L, path, errno);
+
+  struct stat st;
+  if (fstat(fd, &st) != 0) {
+    int err = errno;
+    ::close(fd);
+    return pushError(L, path, err);
+  }
+
+  // An empty file cannot be mapped.
+  size_t size = static_cast<size_t>(st.st_size);
+  void* data = NULL;
+  if (size > 0) {
+    data = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (data == MAP_FAILED) {
+      int err = errno;
+      ::close(fd);
+      return pushError(L, path, err);
+    }
+#ifdef MADV_SEQUENTIAL
+    madvise(data, size, MADV_SEQUENTIAL);
+#endif
+  }
+
+  // The mapping is kept after the descriptor is closed.
+  ::close(fd);
+
+  FileReader** p =
+    static_cast<FileReader**>(lua_newuserdata(L, sizeof(FileReader*)));
+  luaL_getmetatable(L, FileReader::MetatableName);
+  lua_setmetatable(L, -2);
+  *p = new FileReader(static_cast<const char*>(data), size);
+  return 1;
+}
+
+int FileReader::finalizer(lua_State* L) {
+  FileReader* r = *static_cast<FileReader**>(
+    luaL_checkudata(L, 1, FileReader::MetatableName));
+  delete r;
+  return 0;
+}
+
+FileReader::FileReader(const char* data, size_t size)
+  : data_(data), size_(size), offset_(0), closed_(false) {
+}
+
+FileReader::~FileReader() {
+  unmap();
+}
+
+int FileReader::next(lua_State* L) {
+  if (closed_) return luaL_error(L, "attempt to use a closed file");
+  if (offset_ >= size_) return 0;
+
+  size_t n = 0;
+  bool failed = false;
+  try {
+    n = Decoder(L).decode(data_ + offset_, size_ - offset_);
+  } catch (const msgpack::unpack_error& e) {
+    lua_pushfstring(L, "deserialization failed: %s", e.what());
+    failed = true;
+  }
+  if (failed) return lua_error(L);
+  if (n == 0) return 0;
+  offset_ += n;
+  return 1;
+}
+
+int FileReader::seek(lua_State* L) {
+  if (closed_) return luaL_error(L, "attempt to use a closed file");
+  lua_Number offset = luaL_checknumber(L, 2);
+  luaL_argcheck(L, offset >= 0 && offset <= size_, 2, "offset out of range");
+  offset_ = static_cast<size_t>(offset);
+  lua_pushnumber(L, static_cast<lua_Number>(offset_));
+  return 1;
+}
+
+int FileReader::tell(lua_State* L) {
+  if (closed_) return luaL_error(L, "attempt to use a closed file");
+  lua_pushnumber(L, static_cast<lua_Number>(offset_));
+  return 1;
+}
+
+int FileReader::close(lua_State* L) {
+  unmap();
+  return 0;
+}
+
+void FileReader::unmap() {
+  if (closed_) return;
+  if (data_ != NULL) {
+    munmap(const_cast<char*>(data_), size_);
+  }
+  data_ = NULL;
+  closed_ = true;
+}
+
+} // namespace lua
+} // namespace msgpack
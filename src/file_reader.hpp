@@ -0,0 +1,108 @@
+/*
+ * MessagePack for Lua
+ *
+ * Copyright (C) 2010 Nobuyuki Kubota
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef MSGPACK_LUA_FILE_READER_HPP_
+#define MSGPACK_LUA_FILE_READER_HPP_
+
+#include <lua.hpp>
+#include <msgpack.hpp>
+
+namespace msgpack {
+namespace lua {
+
+/**
+ * @brief Reader of a file of serialized objects.
+ *
+ * The file is mapped into memory and objects are deserialized directly
+ * from the mapping, so that the file is read through the page cache
+ * without being copied into Lua strings.
+ *
+ * Usage:
+ * r = msgpack.open(path)
+ * for v in r do
+ *   -- v has deserialized data
+ * end
+ * r:seek(offset)
+ * offset = r:tell()
+ * r:close()
+ *
+ * Offsets are in bytes from the beginning of the file, beginning with 0
+ * like those of file:seek.
+ */
+class FileReader {
+private:
+  FileReader(const FileReader&);
+  FileReader& operator =(const FileReader&);
+
+public:
+  static const char* const MetatableName;
+  static void registerUserdata(lua_State* L);
+
+  /**
+   * @brief Opens the file at the path given as the 1st argument.
+   *
+   * @return The FileReader, or nil and an error message when the file
+   * cannot be opened.
+   */
+  static int create(lua_State* L);
+
+private:
+  static int finalizer(lua_State* L);
+
+public:
+  FileReader(const char* data, size_t size);
+  ~FileReader();
+
+  /**
+   * @brief Deserializes the next object.
+   *
+   * @return The object, or nil when the file has no more complete object.
+   * An incomplete object at the end of the file is left to be read after
+   * the file is reopened.
+   */
+  int next(lua_State* L);
+
+  /**
+   * @brief Sets the offset of the next object.
+   */
+  int seek(lua_State* L);
+
+  /**
+   * @brief Returns the offset of the next object.
+   */
+  int tell(lua_State* L);
+
+  /**
+   * @brief Unmaps the file.
+   */
+  int close(lua_State* L);
+
+private:
+  void unmap();
+
+private:
+  const char* data_;
+  size_t size_;
+  size_t offset_;
+  bool closed_;
+};
+
+} // namespace lua
+} // namespace msgpack
+
+#endif
@@ -0,0 +1,289 @@
+/*
+ * MessagePack for Lua
+ *
+ * Copyright (C) 2010 Nobuyuki Kubota
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef MSGPACK_LUA_FORMAT_HPP_
+#define MSGPACK_LUA_FORMAT_HPP_
+
+#include <cstddef>
+#include <cstring>
+#include <stdint.h>
+
+// Byte swaps between the host order and big endian, defined where the
+// host order is known at compile time.
+#if defined(__GNUC__) && defined(__BYTE_ORDER__)
+#  if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+#    define MSGPACK_LUA_BIG_ENDIAN32(x) __builtin_bswap32(x)
+#    define MSGPACK_LUA_BIG_ENDIAN64(x) __builtin_bswap64(x)
+#  elif __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+#    define MSGPACK_LUA_BIG_ENDIAN32(x) (x)
+#    define MSGPACK_LUA_BIG_ENDIAN64(x) (x)
+#  endif
+#endif
+
+namespace msgpack {
+namespace lua {
+
+/**
+ * @brief Header of a serialized object.
+ *
+ * The header consists of the type byte and following fixed length fields.
+ * Payloads of raw bytes and ext types follow the header, and elements of
+ * arrays and maps follow the header as serialized objects.
+ */
+struct Header {
+  enum Type {
+    NIL,
+    BOOLEAN,
+    UNSIGNED_INTEGER,
+    SIGNED_INTEGER,
+    FLOAT,
+    DOUBLE,
+    RAW, // including str and bin
+    ARRAY,
+    MAP,
+    EXT,
+    INVALID
+  };
+
+  Type type;
+
+  // The size of the header in bytes.
+  size_t size;
+
+  // BOOLEAN: 0 or 1
+  // UNSIGNED_INTEGER: the value
+  // SIGNED_INTEGER: the value casted to uint64_t
+  // FLOAT, DOUBLE: the bit pattern of the value
+  // RAW, EXT: the size of the payload
+  // ARRAY, MAP: the number of elements or entries
+  uint64_t value;
+
+  // The type of EXT.
+  int8_t ext_type;
+
+  /**
+   * @brief The size of the payload following the header.
+   */
+  uint64_t payloadSize() const {
+    return type == RAW || type == EXT ? value : 0;
+  }
+
+  /**
+   * @brief The number of objects following the header as elements.
+   */
+  uint64_t elementCount() const {
+    if (type == ARRAY) return value;
+    if (type == MAP) return value * 2;
+    return 0;
+  }
+};
+
+inline uint64_t loadBigEndian(const char* p, size_t n) {
+  const unsigned char* u = reinterpret_cast<const unsigned char*>(p);
+  uint64_t v = 0;
+  for (size_t i = 0; i < n; i++) v = (v << 8) | u[i];
+  return v;
+}
+
+inline void storeBigEndian(char* p, uint64_t v, size_t n) {
+  for (size_t i = n; i > 0; i--) {
+    p[i - 1] = static_cast<char>(v);
+    v >>= 8;
+  }
+}
+
+/**
+ * @brief Fixed width versions of loadBigEndian and storeBigEndian, which
+ * are a load or a store and a byte swap where the host order is known so
+ * that loops over arrays can be vectorized.
+ */
+inline uint32_t loadBigEndian32(const char* p) {
+#ifdef MSGPACK_LUA_BIG_ENDIAN32
+  uint32_t v;
+  memcpy(&v, p, sizeof(v));
+  return MSGPACK_LUA_BIG_ENDIAN32(v);
+#else
+  return static_cast<uint32_t>(loadBigEndian(p, 4));
+#endif
+}
+
+inline uint64_t loadBigEndian64(const char* p) {
+#ifdef MSGPACK_LUA_BIG_ENDIAN64
+  uint64_t v;
+  memcpy(&v, p, sizeof(v));
+  return MSGPACK_LUA_BIG_ENDIAN64(v);
+#else
+  return loadBigEndian(p, 8);
+#endif
+}
+
+inline void storeBigEndian32(char* p, uint32_t v) {
+#ifdef MSGPACK_LUA_BIG_ENDIAN32
+  v = MSGPACK_LUA_BIG_ENDIAN32(v);
+  memcpy(p, &v, sizeof(v));
+#else
+  storeBigEndian(p, v, 4);
+#endif
+}
+
+inline void storeBigEndian64(char* p, uint64_t v) {
+#ifdef MSGPACK_LUA_BIG_ENDIAN64
+  v = MSGPACK_LUA_BIG_ENDIAN64(v);
+  memcpy(p, &v, sizeof(v));
+#else
+  storeBigEndian(p, v, 8);
+#endif
+}
+
+/**
+ * @brief Reads the header of the object at the beginning of data.
+ *
+ * @return false if data is shorter than the header. The type of the header
+ * is INVALID when data does not begin with a valid type byte.
+ */
+inline bool readHeader(const char* data, size_t size, Header* h) {
+  if (size == 0) return false;
+
+  unsigned char c = static_cast<unsigned char>(data[0]);
+  h->size = 1;
+  h->ext_type = 0;
+  if (c <= 0x7f) {
+    h->type = Header::UNSIGNED_INTEGER;
+    h->value = c;
+    return true;
+  }
+  if (c >= 0xe0) {
+    h->type = Header::SIGNED_INTEGER;
+    h->value = static_cast<uint64_t>(
+      static_cast<int64_t>(static_cast<int8_t>(c)));
+    return true;
+  }
+  if (c <= 0x8f) {
+    h->type = Header::MAP;
+    h->value = c & 0x0f;
+    return true;
+  }
+  if (c <= 0x9f) {
+    h->type = Header::ARRAY;
+    h->value = c & 0x0f;
+    return true;
+  }
+  if (c <= 0xbf) {
+    h->type = Header::RAW;
+    h->value = c & 0x1f;
+    return true;
+  }
+
+  // c is in [0xc0, 0xdf]
+  size_t len; // the size of the field following the type byte
+  switch (c) {
+  case 0xc0: h->type = Header::NIL; h->value = 0; return true;
+  case 0xc2: h->type = Header::BOOLEAN; h->value = 0; return true;
+  case 0xc3: h->type = Header::BOOLEAN; h->value = 1; return true;
+
+  case 0xc4: h->type = Header::RAW; len = 1; break; // bin 8
+  case 0xc5: h->type = Header::RAW; len = 2; break; // bin 16
+  case 0xc6: h->type = Header::RAW; len = 4; break; // bin 32
+  case 0xc7: h->type = Header::EXT; len = 1; break; // ext 8
+  case 0xc8: h->type = Header::EXT; len = 2; break; // ext 16
+  case 0xc9: h->type = Header::EXT; len = 4; break; // ext 32
+  case 0xca: h->type = Header::FLOAT; len = 4; break;
+  case 0xcb: h->type = Header::DOUBLE; len = 8; break;
+  case 0xcc: h->type = Header::UNSIGNED_INTEGER; len = 1; break;
+  case 0xcd: h->type = Header::UNSIGNED_INTEGER; len = 2; break;
+  case 0xce: h->type = Header::UNSIGNED_INTEGER; len = 4; break;
+  case 0xcf: h->type = Header::UNSIGNED_INTEGER; len = 8; break;
+  case 0xd0: h->type = Header::SIGNED_INTEGER; len = 1; break;
+  case 0xd1: h->type = Header::SIGNED_INTEGER; len = 2; break;
+  case 0xd2: h->type = Header::SIGNED_INTEGER; len = 4; break;
+  case 0xd3: h->type = Header::SIGNED_INTEGER; len = 8; break;
+  case 0xd4: case 0xd5: case 0xd6: case 0xd7: case 0xd8: // fixext
+    if (size < 2) return false;
+    h->type = Header::EXT;
+    h->size = 2;
+    h->value = 1u << (c - 0xd4);
+    h->ext_type = static_cast<int8_t>(data[1]);
+    return true;
+  case 0xd9: h->type = Header::RAW; len = 1; break; // str 8
+  case 0xda: h->type = Header::RAW; len = 2; break; // raw 16
+  case 0xdb: h->type = Header::RAW; len = 4; break; // raw 32
+  case 0xdc: h->type = Header::ARRAY; len = 2; break;
+  case 0xdd: h->type = Header::ARRAY; len = 4; break;
+  case 0xde: h->type = Header::MAP; len = 2; break;
+  case 0xdf: h->type = Header::MAP; len = 4; break;
+  default: h->type = Header::INVALID; h->value = 0; return true; // 0xc1
+  }
+
+  size_t header_size = 1 + len + (h->type == Header::EXT ? 1 : 0);
+  if (size < header_size) return false;
+  h->size = header_size;
+  h->value = loadBigEndian(data + 1, len);
+  if (h->type == Header::EXT) {
+    h->ext_type = static_cast<int8_t>(data[1 + len]);
+  } else if (h->type == Header::SIGNED_INTEGER && len < 8) {
+    // sign extension
+    int shift = static_cast<int>(64 - len * 8);
+    h->value = static_cast<uint64_t>(
+      static_cast<int64_t>(h->value << shift) >> shift);
+  }
+  return true;
+}
+
+/**
+ * @brief Returns true if the type byte makes an object by itself, i.e.
+ * the object is a fixint, nil or a boolean.
+ */
+inline bool isSingleByteObject(char c) {
+  unsigned char u = static_cast<unsigned char>(c);
+  return u <= 0x7f || u >= 0xe0 || u == 0xc0 || u == 0xc2 || u == 0xc3;
+}
+
+/**
+ * @brief Skips an object at the beginning of data.
+ *
+ * @return The end of the object, or NULL when data does not have the
+ * complete object. When data is malformed, the type of h is set to
+ * INVALID and NULL is returned.
+ */
+inline const char* skipObject(const char* p, const char* end, Header* h) {
+  // the number of objects to be skipped
+  uint64_t n = 1;
+  while (n > 0) {
+    // Runs of single byte objects, common in arrays of small integers,
+    // are skipped without reading their headers.
+    while (p < end && isSingleByteObject(*p)) {
+      p++;
+      if (--n == 0) return p;
+    }
+
+    if (!readHeader(p, end - p, h)) return NULL;
+    if (h->type == Header::INVALID) return NULL;
+
+    p += h->size;
+    uint64_t payload_size = h->payloadSize();
+    if (static_cast<uint64_t>(end - p) < payload_size) return NULL;
+    p += payload_size;
+    n += h->elementCount() - 1;
+  }
+  return p;
+}
+
+} // namespace lua
+} // namespace msgpack
+
+#endif
@@ -0,0 +1,96 @@
+/*
+ * MessagePack for Lua
+ *
+ * Copyright (C) 2010 Nobuyuki Kubota
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "limits.hpp"
+
+#include <msgpack.hpp>
+#include "ext_registry.hpp"
+#include "format.hpp"
+#include "options.hpp"
+#include "shared_references.hpp"
+
+namespace msgpack {
+namespace lua {
+
+const size_t Limits::Unlimited;
+
+Limits::Limits()
+  : max_buffer_size_(Unlimited), max_elements_(Unlimited),
+    max_depth_(Unlimited), max_string_length_(Unlimited),
+    max_objects_(Unlimited) {
+}
+
+void Limits::parseOptions(lua_State* L, int options) {
+  max_buffer_size_ =
+    getSizeOption(L, options, "max_buffer_size", max_buffer_size_);
+  max_elements_ = getSizeOption(L, options, "max_elements", max_elements_);
+  max_depth_ = getSizeOption(L, options, "max_depth", max_depth_);
+  max_string_length_ =
+    getSizeOption(L, options, "max_string_length", max_string_length_);
+  max_objects_ = getSizeOption(L, options, "max_objects", max_objects_);
+}
+
+void Limits::check(const Header& h, size_t depth, size_t* objects) const {
+  if (++*objects > max_objects_) {
+    throw msgpack::unpack_error("too many objects");
+  }
+
+  switch (h.type) {
+  case Header::RAW:
+  case Header::EXT:
+    // Objects in an envelope or a class object are checked when they are
+    // deserialized.
+    if (h.type == Header::EXT &&
+        (h.ext_type == SharedReferences::EnvelopeExtType ||
+         h.ext_type == ExtRegistry::ClassExtType)) {
+      break;
+    }
+    if (h.value > max_string_length_) {
+      throw msgpack::unpack_error("string too long");
+    }
+    break;
+
+  case Header::ARRAY:
+  case Header::MAP:
+    if (h.value > max_elements_) {
+      throw msgpack::unpack_error("too many elements");
+    }
+    if (depth >= max_depth_) {
+      throw msgpack::unpack_error("too deeply nested");
+    }
+    break;
+
+  case Header::NIL:
+  case Header::BOOLEAN:
+  case Header::UNSIGNED_INTEGER:
+  case Header::SIGNED_INTEGER:
+  case Header::FLOAT:
+  case Header::DOUBLE:
+  case Header::INVALID:
+  default:
+    break;
+  }
+}
+
+bool Limits::limitsObjects() const {
+  return max_elements_ != Unlimited || max_depth_ != Unlimited ||
+    max_string_length_ != Unlimited || max_objects_ != Unlimited;
+}
+
+} // namespace lua
+} // namespace msgpack
@@ -0,0 +1,85 @@
+/*
+ * MessagePack for Lua
+ *
+ * Copyright (C) 2010 Nobuyuki Kubota
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef MSGPACK_LUA_LIMITS_HPP_
+#define MSGPACK_LUA_LIMITS_HPP_
+
+#include <cstddef>
+#include <lua.hpp>
+
+namespace msgpack {
+namespace lua {
+
+struct Header;
+
+/**
+ * @brief Limits on deserialized objects.
+ *
+ * Limits are checked against headers before the data following them is
+ * buffered or deserialized, so that a broken or hostile header cannot
+ * make a large allocation. Every limit is unlimited by default.
+ *
+ * options:
+ *   max_buffer_size: the size of data buffered or passed at once
+ *   max_elements: the number of elements of an array or entries of a map
+ *   max_depth: the depth of nested arrays and maps
+ *   max_string_length: the size of a string or an ext payload
+ *   max_objects: the number of objects in a top-level object, including
+ *                itself
+ */
+class Limits {
+public:
+  static const size_t Unlimited = static_cast<size_t>(-1);
+
+  Limits();
+
+  /**
+   * @brief Reads limits from the options table at the given index.
+   */
+  void parseOptions(lua_State* L, int options);
+
+  /**
+   * @brief Checks the header of an object.
+   *
+   * @param depth The number of arrays and maps containing the object.
+   * @param objects The number of objects checked in the top-level object,
+   * which is incremented.
+   *
+   * @throw msgpack::unpack_error when the object exceeds a limit.
+   */
+  void check(const Header& h, size_t depth, size_t* objects) const;
+
+  /**
+   * @brief Returns true if any limit other than max_buffer_size is set.
+   */
+  bool limitsObjects() const;
+
+  size_t maxBufferSize() const { return max_buffer_size_; }
+
+private:
+  size_t max_buffer_size_;
+  size_t max_elements_;
+  size_t max_depth_;
+  size_t max_string_length_;
+  size_t max_objects_;
+};
+
+} // namespace lua
+} // namespace msgpack
+
+#endif
@@ -18,13 +18,22 @@
 
 #include "lua_objects.hpp"
 
+#include "ext_registry.hpp"
+#include "numeric_array.hpp"
+#include "shared_references.hpp"
+
 namespace msgpack {
 namespace lua {
 
 LuaObjects::LuaObjects(lua_State* L, int arg_base, bool pack_as_array)
-  : L(L), arg_base_(arg_base), pack_as_array_(pack_as_array) {
+  : L(L), arg_base_(arg_base), pack_as_array_(pack_as_array),
+    max_depth_(Unlimited), dedup_(false), dictionary_(NULL),
+    dictionary_argument_(true), dict_(0), dict_size_(0), refs_(0),
+    next_ref_(0), ext_(NULL), ext_loaded_(false) {
 }
 
+const size_t LuaObjects::Unlimited;
+
 void LuaObjects::msgpack_unpack(const msgpack::object& msg) {
   namespace type = msgpack::type;
   switch (msg.type) {
@@ -69,6 +78,115 @@ void LuaObjects::msgpack_unpack(const msgpack::object& msg) {
   }
 }
 
+bool LuaObjects::packNumericArray(BufferPacker& pk, int index) const {
+  NumericArray::Type type;
+  if (!NumericArray::marked(L, index, &type)) return false;
+  NumericArray::pack(L, index, type, pk.buffer());
+  return true;
+}
+
+void LuaObjects::packRoot(BufferPacker& pk, int index, TableType type) const {
+  size_t start = pk.buffer().size();
+  if (!dedup_) {
+    pack(pk, index, type);
+  } else {
+    size_t header = pk.reserveExtHeader();
+    lua_newtable(L);
+    refs_ = lua_gettop(L);
+    next_ref_ = 0;
+    pack(pk, index, type);
+    lua_pop(L, 1);
+    refs_ = 0;
+    pk.fixExtHeader(header, SharedReferences::EnvelopeExtType);
+  }
+  pk.compact(start);
+}
+
+void LuaObjects::packElements(BufferPacker& pk, bool length_prefix,
+                              int ends) const {
+  beginArguments();
+  msgpack::sbuffer& buffer = pk.buffer();
+  size_t n = lua_objlen(L, arg_base_);
+  for (size_t i = 1; i <= n; i++) {
+    size_t start = buffer.size();
+    if (length_prefix) buffer.write("\0\0\0\0", 4);
+
+    lua_rawgeti(L, arg_base_, static_cast<int>(i));
+    packRoot(pk, lua_gettop(L), ANY_TABLE);
+    lua_pop(L, 1);
+
+    if (length_prefix) {
+      size_t size = buffer.size() - start - 4;
+      if (size > 0xffffffffU) {
+        throwPackError(L, "object too large for a length prefix");
+      }
+      char* p = buffer.data() + start;
+      p[0] = static_cast<char>(size >> 24);
+      p[1] = static_cast<char>(size >> 16);
+      p[2] = static_cast<char>(size >> 8);
+      p[3] = static_cast<char>(size);
+    }
+    if (ends != 0) {
+      lua_pushnumber(L, static_cast<lua_Number>(buffer.size()));
+      lua_rawseti(L, ends, static_cast<int>(i));
+    }
+  }
+  endArguments();
+}
+
+bool LuaObjects::packExt(BufferPacker& pk, int index) const {
+  const ExtRegistry* ext = extRegistry();
+  return ext != NULL && ext->pack(L, index, pk);
+}
+
+bool LuaObjects::packTableAsClass(BufferPacker& pk, Frame& f) const {
+  const ExtRegistry* ext = extRegistry();
+  if (ext == NULL) return false;
+  const ExtRegistry::Class* c = ext->findClass(L, f.index);
+  if (c == NULL) return false;
+
+  lua_rawgeti(L, LUA_REGISTRYINDEX, c->fields_ref);
+  f.len = c->size + 1;
+  f.header = pk.reserveExtHeader();
+  pk.pack_array(static_cast<unsigned int>(f.len));
+  return true;
+}
+
+void LuaObjects::endClass(BufferPacker& pk, size_t header) const {
+  pk.fixExtHeader(header, ExtRegistry::ClassExtType);
+}
+
+const ExtRegistry* LuaObjects::extRegistry() const {
+  if (!ext_loaded_) {
+    ext_ = ExtRegistry::get(L);
+    ext_loaded_ = true;
+  }
+  return ext_;
+}
+
+bool LuaObjects::packReference(BufferPacker& pk, int index) const {
+  if (refs_ == 0) return false;
+  if (lua_type(L, index) == LUA_TSTRING &&
+      lua_objlen(L, index) < SharedReferences::MinStringSize) {
+    return false;
+  }
+
+  lua_pushvalue(L, index);
+  lua_rawget(L, refs_);
+  if (!lua_isnil(L, -1)) {
+    uint32_t id = static_cast<uint32_t>(lua_tonumber(L, -1));
+    lua_pop(L, 1);
+    SharedReferences::pack(pk.buffer(), id);
+    return true;
+  }
+  lua_pop(L, 1);
+
+  lua_pushvalue(L, index);
+  lua_pushnumber(L, next_ref_++);
+  lua_rawset(L, refs_);
+  return false;
+}
+
 void LuaObjects::unpackArray(const object_array& a) {
   lua_newtable(L);
   for (uint32_t i = 0; i < a.size; i++) {
@@ -19,27 +19,71 @@
 #ifndef MSGPACK_RPC_LUA_LUA_OBJECT_HPP_
 #define MSGPACK_RPC_LUA_LUA_OBJECT_HPP_
 
+#include <vector>
 #include <lua.hpp>
 #include <msgpack.hpp>
+#include "buffer_packer.hpp"
+#include "dictionary.hpp"
+#include "pack_error.hpp"
 
 namespace msgpack {
 namespace lua {
 
+class ExtRegistry;
+
 /**
  * @brief Lua Object class for serialization.
+ *
+ * Errors while packing are thrown as PackError, leaving values pushed
+ * onto the stack and data written to the packer.
  */
 class LuaObjects {
 public:
+  static const size_t Unlimited = static_cast<size_t>(-1);
+
   /**
    * @param arg_base This is necessary only when LuaObjects will be serialized
    */
   LuaObjects(lua_State* L, int arg_base = 0, bool pack_as_array = false);
 
+  /**
+   * @brief Sets the maximum depth of nested tables to be packed.
+   */
+  void setMaxDepth(size_t depth) { max_depth_ = depth; }
+
+  /**
+   * @brief Enables packing shared tables and repeated strings as
+   * references.
+   *
+   * Only BufferPacker supports references. See SharedReferences.
+   */
+  void setDedup(bool dedup) { dedup_ = dedup; }
+
+  /**
+   * @brief Sets the Dictionary used for map keys, or NULL.
+   *
+   * A Dictionary given as the last argument is used instead, and is not
+   * packed.
+   */
+  void setDictionary(const Dictionary* dictionary) {
+    dictionary_ = dictionary;
+  }
+
+  /**
+   * @brief Sets whether a Dictionary given as the last argument is used
+   * for map keys. It is true by default. When it is false, the Dictionary
+   * is packed as a value.
+   */
+  void setDictionaryArgument(bool enabled) {
+    dictionary_argument_ = enabled;
+  }
+
   template<typename Packer>
   void msgpack_pack(Packer& pk) const {
-    int n = lua_gettop(L);
+    int n = beginArguments();
     if (arg_base_ > n) {
       if (pack_as_array_) pk.pack_array(0);
+      endArguments();
       return;
     }
 
@@ -48,67 +92,193 @@ public:
     // each element will be serialized independently.
     if (pack_as_array_) pk.pack_array(n - arg_base_ + 1);
     for (int i = arg_base_; i <= n; i++) {
-      pack(pk, i);
+      packRoot(pk, i, ANY_TABLE);
     }
+    endArguments();
   }
 
   template<typename Packer>
   void packTable(Packer& pk) const {
-    int n = lua_gettop(L);
+    int n = beginArguments();
     for (int i = arg_base_; i <= n; i++) {
       int t = lua_type(L, i);
       if (t != LUA_TTABLE) {
-        luaL_error(L, "Arguments must be tables.");
-        return;
+        throwPackError(L, "Arguments must be tables.");
       }
-      packTableAsTable(pk, i);
+      packRoot(pk, i, MAP);
     }
+    endArguments();
   }
 
   template<typename Packer>
   void packArray(Packer& pk) const {
-    int n = lua_gettop(L);
+    int n = beginArguments();
     for (int i = arg_base_; i <= n; i++) {
       int t = lua_type(L, i);
       if (t != LUA_TTABLE) {
-        luaL_error(L, "Arguments must be tables.");
-        return;
+        throwPackError(L, "Arguments must be tables.");
       }
-      packTableAsArray(pk, i);
+      packRoot(pk, i, ARRAY);
     }
+    endArguments();
   }
 
+  /**
+   * @brief Packs each element of the array at arg_base as an object.
+   *
+   * @param length_prefix If true, each object is preceded by its size in
+   * 4 bytes in big endian.
+   * @param ends If not 0, the index of the table which the end offset of
+   * each object in the buffer is appended to.
+   */
+  void packElements(BufferPacker& pk, bool length_prefix, int ends) const;
+
   void msgpack_unpack(const msgpack::object& msg);
 
 private:
+  /**
+   * @brief The way to pack a table.
+   */
+  enum TableType {
+    ANY_TABLE, // as an array or a map depending on its keys
+    ARRAY,
+    MAP,
+    CLASS // as a class registered in ExtRegistry
+  };
+
+  /**
+   * @brief A table being packed by packTables.
+   */
+  struct Frame {
+    int index; // the index of the table in the stack
+    TableType type; // ARRAY, MAP or CLASS
+
+    // array and class: the index of the next element and the number of
+    // elements
+    size_t next;
+    size_t len;
+
+    // map and class: the offset of the header
+    // map: the number of entries, and whether the key of the current entry
+    // is a table which has been packed
+    size_t header;
+    uint32_t count;
+    bool packing_value;
+  };
+
+  /**
+   * @brief Pushes the table of the Dictionary, if any.
+   *
+   * @return The index of the last argument to be packed.
+   */
+  int beginArguments() const {
+    int n = lua_gettop(L);
+    const Dictionary* dictionary = dictionary_;
+    if (dictionary_argument_ && n >= arg_base_ &&
+        lua_type(L, n) == LUA_TUSERDATA) {
+      const Dictionary* d = Dictionary::toDictionary(L, n);
+      if (d != NULL) {
+        dictionary = d;
+        n--;
+      }
+    }
+    if (dictionary != NULL) {
+      dictionary->push(L);
+      dict_ = lua_gettop(L);
+      dict_size_ = dictionary->size();
+    }
+    return n;
+  }
+
+  /**
+   * @brief Pops the table pushed by beginArguments.
+   */
+  void endArguments() const {
+    if (dict_ == 0) return;
+    lua_pop(L, 1);
+    dict_ = 0;
+  }
+
+  /**
+   * @brief Packs an argument.
+   */
+  template<typename Packer>
+  void packRoot(Packer& pk, int index, TableType type) const {
+    pack(pk, index, type);
+  }
+
+  /**
+   * @brief packRoot which wraps the argument in an envelope of
+   * SharedReferences in dedup mode, and removes gaps left by headers.
+   */
+  void packRoot(BufferPacker& pk, int index, TableType type) const;
+
   // TODO: merge these with mplua's implementation
   template<typename Packer>
-  void pack(Packer& pk, int index) const {
+  void pack(Packer& pk, int index, TableType type) const {
     int t = lua_type(L, index);
+    if (t == LUA_TTABLE) {
+      lua_pushvalue(L, index);
+      packTables(pk, type);
+      return;
+    }
+    packScalar(pk, index, t);
+  }
+
+  /**
+   * @brief Packs a value other than a table.
+   */
+  template<typename Packer>
+  void packScalar(Packer& pk, int index, int t) const {
     switch (t) {
     case LUA_TNUMBER: packNumber(pk, index); break;
     case LUA_TBOOLEAN: packBoolean(pk, index); break;
-    case LUA_TSTRING:  packString(pk, index); break;
-    case LUA_TTABLE: packTable(pk, index); break;
+    case LUA_TSTRING:
+      if (!packReference(pk, index)) packString(pk, index);
+      break;
     case LUA_TUSERDATA:
-      // TODO: support userdata serialization.
-      // Calling __serialize meta-method may be good.
-
-      // raise an error temporally
-      luaL_error(L, "Packing userdata has not been supported yet. "
-                 "However, it will be implemented soon.");
-      return;
+      if (!packExt(pk, index)) {
+        throwPackError(L, "no ext type is registered for the userdata");
+      }
+      break;
 
     case LUA_TNIL:
     case LUA_TTHREAD:
     case LUA_TLIGHTUSERDATA:
     default:
-      luaL_error(L, "invalid type for pack: %s",
-                 lua_typename(L, t));
+      throwPackError(L, "invalid type for pack: %s", lua_typename(L, t));
       break;
     }
   }
 
+  /**
+   * @brief Packs a map key other than a table.
+   */
+  template<typename Packer>
+  void packKey(Packer& pk, int index, int t) const {
+    if (dict_ != 0) {
+      if (t == LUA_TSTRING) {
+        lua_pushvalue(L, index);
+        lua_rawget(L, dict_);
+        if (!lua_isnil(L, -1)) {
+          pk.pack(static_cast<int64_t>(lua_tonumber(L, -1)));
+          lua_pop(L, 1);
+          return;
+        }
+        lua_pop(L, 1);
+      } else if (t == LUA_TNUMBER) {
+        // An integral key colliding with a position in the dictionary is
+        // packed as a double, which is unpacked as the same Lua number.
+        double n = lua_tonumber(L, index);
+        if (n >= 1 && n <= dict_size_ && n == static_cast<int64_t>(n)) {
+          pk.pack(n);
+          return;
+        }
+      }
+    }
+    packScalar(pk, index, t);
+  }
+
   template<typename Packer>
   void packNumber(Packer& pk, int index) const {
     double n = lua_tonumber(L, index);
@@ -129,19 +299,163 @@ private:
     const char* str = lua_tolstring(L, index, &len);
     if (str == NULL) {
       int t = lua_type(L, index);
-      luaL_error(L, "lua_tolstring failed for index %d: type = %s",
-                 index, lua_typename(L, t));
-      return;
+      throwPackError(L, "lua_tolstring failed for index %d: type = %s",
+                     index, lua_typename(L, t));
     }
     pk.pack_raw(len);
     pk.pack_raw_body(str, len);
   }
 
+  /**
+   * @brief Packs the table on the top of the stack and pops it.
+   *
+   * Nested tables are packed with an explicit stack of frames instead of
+   * recursion, so the depth of tables is limited only by max_depth and
+   * the size of the Lua stack. Each frame uses at most 5 slots of the Lua
+   * stack: the table, the key and the value of the current entry, and 2
+   * slots to pack them. Tables being packed are the keys of a table below
+   * the frames, which detects cycles.
+   */
+  template<typename Packer>
+  void packTables(Packer& pk, TableType type) const {
+    std::vector<Frame> frames;
+    if (!lua_checkstack(L, 1)) throwPackError(L, "too deeply nested");
+    lua_newtable(L);
+    lua_insert(L, -2);
+    int visited = lua_gettop(L) - 1;
+    beginTable(pk, type, visited, frames);
+
+    while (!frames.empty()) {
+      Frame& f = frames.back();
+      if (f.type == ARRAY) {
+        if (f.next > f.len) {
+          endTable(pk, visited, frames);
+          continue;
+        }
+        lua_rawgeti(L, f.index, static_cast<int>(f.next++));
+      } else if (f.type == CLASS) {
+        if (f.next > f.len) {
+          endTable(pk, visited, frames);
+          continue;
+        }
+        // The name of the class, and then the values of the fields.
+        lua_rawgeti(L, f.index + 1, static_cast<int>(f.next));
+        if (f.next++ > 1) lua_rawget(L, f.index);
+        if (lua_isnil(L, -1)) {
+          pk.pack_nil();
+          lua_pop(L, 1);
+          continue;
+        }
+      } else if (f.packing_value) {
+        f.packing_value = false; // the value is on the top
+      } else {
+        if (lua_next(L, f.index) == 0) {
+          endTable(pk, visited, frames);
+          continue;
+        }
+        f.count++;
+
+        // -2:key, -1:value
+        // A table key is packed as a copy so that the key remains for the
+        // next iteration. Other keys are packed in place.
+        int t = lua_type(L, -2);
+        if (t == LUA_TTABLE) {
+          f.packing_value = true;
+          lua_pushvalue(L, -2);
+        } else {
+          packKey(pk, lua_gettop(L) - 1, t);
+        }
+      }
+
+      // f may be invalidated from here on.
+      int t = lua_type(L, -1);
+      if (t == LUA_TTABLE) {
+        beginTable(pk, ANY_TABLE, visited, frames);
+      } else {
+        packScalar(pk, lua_gettop(L), t);
+        lua_pop(L, 1);
+      }
+    }
+    lua_pop(L, 1); // visited
+  }
+
+  /**
+   * @brief Writes the header of the table on the top of the stack and
+   * pushes its frame.
+   *
+   * @param visited The index of the table having tables being packed as
+   * keys.
+   */
+  template<typename Packer>
+  void beginTable(Packer& pk, TableType type, int visited,
+                  std::vector<Frame>& frames) const {
+    int index = lua_gettop(L);
+    // An ext object is not numbered as a reference.
+    if ((type == ANY_TABLE &&
+         (packNumericArray(pk, index) || packExt(pk, index))) ||
+        packReference(pk, index)) {
+      lua_pop(L, 1);
+      return;
+    }
+
+    if (frames.size() >= max_depth_ || !lua_checkstack(L, 5)) {
+      throwPackError(L, "too deeply nested");
+    }
+    lua_pushvalue(L, index);
+    lua_rawget(L, visited);
+    if (!lua_isnil(L, -1)) {
+      throwPackError(L, "cannot pack a table containing itself");
+    }
+    lua_pop(L, 1);
+    lua_pushvalue(L, index);
+    lua_pushboolean(L, 1);
+    lua_rawset(L, visited);
+
+    Frame f;
+    f.index = index;
+    f.next = 1;
+    f.len = 0;
+    f.header = 0;
+    f.count = 0;
+    f.packing_value = false;
+    if (type == ANY_TABLE && packTableAsClass(pk, f)) {
+      f.type = CLASS;
+    } else if (type == ARRAY || (type == ANY_TABLE && isArray(index))) {
+      f.type = ARRAY;
+      f.len = lua_objlen(L, index);
+      pk.pack_array(f.len);
+    } else {
+      f.type = MAP;
+      f.header = beginMap(pk, index);
+      lua_pushnil(L);
+    }
+    frames.push_back(f);
+  }
+
+  /**
+   * @brief Finishes the table of the last frame and pops it.
+   */
   template<typename Packer>
-  void packTable(Packer& pk, int index) const {
-    // TODO: support serialize meta-method for Lua classes.
+  void endTable(Packer& pk, int visited, std::vector<Frame>& frames) const {
+    const Frame& f = frames.back();
+    if (f.type == MAP) {
+      endMap(pk, f.header, f.count);
+    } else if (f.type == CLASS) {
+      endClass(pk, f.header);
+      lua_pop(L, 1); // the fields
+    }
+    lua_pushvalue(L, f.index);
+    lua_pushnil(L);
+    lua_rawset(L, visited);
+    lua_pop(L, 1);
+    frames.pop_back();
+  }
 
-    // check if this is an array
+  /**
+   * @brief Returns true if the table at the given index should be packed
+   * as an array.
+   */
+  bool isArray(int index) const {
     // NOTE: This code strongly depends on the internal implementation
     // of Lua5.1. The table in Lua5.1 consists of two parts: the array part
     // and the hash part. The array part is placed before the hash part.
@@ -152,66 +466,125 @@ private:
     //
     // Due to the specification of Lua, the table with non-continous integral
     // keys is detected as a table, not an array.
-    bool is_array = false;
     size_t len = lua_objlen(L, index);
-    if (len > 0) {
-      lua_pushnumber(L, len);
-      if (lua_next(L, index) == 0) is_array = true;
-      else lua_pop(L, 2);
-    }
-
-    if (is_array) packTableAsArray(pk, index);
-    else packTableAsTable(pk, index);
+    if (len == 0) return false;
+    lua_pushnumber(L, len);
+    if (lua_next(L, index) == 0) return true;
+    lua_pop(L, 2);
+    return false;
   }
 
+  /**
+   * @brief Writes the header of the map at the given index.
+   *
+   * @return The value to be passed to endMap.
+   */
   template<typename Packer>
-  void packTableAsTable(Packer& pk, int index) const {
+  size_t beginMap(Packer& pk, int index) const {
     // calc the size of the table
-    // TODO: Make this faster!!
+    // NOTE: Packers which cannot rewrite a written header have to traverse
+    // the table twice. See the overload for BufferPacker below.
     size_t len = 0;
     lua_pushnil(L);
     while (lua_next(L, index) != 0) {
       len++; lua_pop(L, 1);
     }
     pk.pack_map(len);
+    return 0;
+  }
 
-    int n = lua_gettop(L); // used as a positive index
-    lua_pushnil(L);
-    while (lua_next(L, index) != 0) {  
-      pack(pk, n + 1); // -2:key
-      pack(pk, n + 2); // -1:value
-      lua_pop(L, 1); // removes value, keeps key for next iteration
-    }
+  template<typename Packer>
+  void endMap(Packer& pk, size_t header, uint32_t count) const {
+  }
+
+  /**
+   * @brief beginMap which traverses the table only once.
+   *
+   * The map header is reserved before packing entries and fixed by endMap
+   * after counting them.
+   */
+  size_t beginMap(BufferPacker& pk, int index) const {
+    return pk.reserveMapHeader();
+  }
+
+  void endMap(BufferPacker& pk, size_t header, uint32_t count) const {
+    pk.fixMapHeader(header, count);
   }
 
+  /**
+   * @brief Packs the table as a numeric array if it is marked by
+   * msgpack.numbers.
+   *
+   * Only BufferPacker can write the ext object, so other packers pack the
+   * table in the ordinary way.
+   *
+   * @return false if the table has not been packed.
+   */
   template<typename Packer>
-  void packTableAsArray(Packer& pk, int index) const {
-    int n = lua_gettop(L);
-    size_t len = lua_objlen(L, index);
+  bool packNumericArray(Packer& pk, int index) const {
+    return false;
+  }
 
-    pk.pack_array(len);
-    for (size_t i = 1; i <= len; i++) {
-      lua_rawgeti(L, index, i);
-      pack(pk, n + 1);
-      lua_pop(L, 1);
-    }
+  bool packNumericArray(BufferPacker& pk, int index) const;
+
+  /**
+   * @brief Packs a reference if the table or the string at the given
+   * index has already been packed in dedup mode. Otherwise, numbers it.
+   *
+   * @return false if the value has to be packed.
+   */
+  template<typename Packer>
+  bool packReference(Packer& pk, int index) const {
+    return false;
   }
 
+  bool packReference(BufferPacker& pk, int index) const;
+
+  /**
+   * @brief Begins packing the table of the frame as a class object if its
+   * metatable is registered as a class in ExtRegistry.
+   *
+   * The header of the ext object and the array are written, and the table
+   * of the name and field names of the class is pushed. The frame has the
+   * offset of the ext header and the number of elements of the array.
+   *
+   * Only BufferPacker can write the ext object.
+   *
+   * @return false if the table is not of a class.
+   */
   template<typename Packer>
-  void packTableAsClass(Packer& pk, int index) const {
-    // TODO: implement
+  bool packTableAsClass(Packer& pk, Frame& f) const {
+    return false;
   }
 
+  bool packTableAsClass(BufferPacker& pk, Frame& f) const;
+
   template<typename Packer>
-  void packTableAsUserdata(Packer& pk, int index) const {
-    // TODO: support userdata serialization.
-    // Calling __serialize meta-method may be good.
+  void endClass(Packer& pk, size_t header) const {
+  }
 
-    // raise an error temporally
-    luaL_error(L, "Packing userdata has not been supported yet. "
-               "However, it will be implemented soon.");
+  void endClass(BufferPacker& pk, size_t header) const;
+
+  /**
+   * @brief Packs the value as an ext object if its metatable is registered
+   * in ExtRegistry.
+   *
+   * Only BufferPacker can write the ext object.
+   *
+   * @return false if the value has not been packed.
+   */
+  template<typename Packer>
+  bool packExt(Packer& pk, int index) const {
+    return false;
   }
 
+  bool packExt(BufferPacker& pk, int index) const;
+
+  /**
+   * @brief Returns the ExtRegistry, looking it up at the first call.
+   */
+  const ExtRegistry* extRegistry() const;
+
 private:
   void unpackArray(const msgpack::object_array& a);
   void unpackTable(const msgpack::object_map& m);
@@ -220,6 +593,25 @@ private:
   lua_State* L;
   int arg_base_;
   bool pack_as_array_;
+  size_t max_depth_;
+  bool dedup_;
+  const Dictionary* dictionary_;
+  bool dictionary_argument_;
+
+  // The index of the table of the Dictionary while arguments are packed,
+  // or 0, and the number of keys in it.
+  mutable int dict_;
+  mutable size_t dict_size_;
+
+  // In dedup mode, the index of the table mapping packed values to their
+  // numbers while an argument is packed, or 0.
+  mutable int refs_;
+  mutable uint32_t next_ref_;
+
+  // The ExtRegistry looked up when a value having a metatable is packed
+  // first.
+  mutable const ExtRegistry* ext_;
+  mutable bool ext_loaded_;
 };
 
 } // namespace lua
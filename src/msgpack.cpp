@@ -18,10 +18,21 @@
 
 #include <lua.hpp>
 
+#include "decoder.hpp"
+#include "dictionary.hpp"
+#include "ext_registry.hpp"
+#include "file_reader.hpp"
+#include "format.hpp"
+#include "limits.hpp"
 #include "lua_objects.hpp"
+#include "numeric_array.hpp"
 #include "packer.hpp"
 #include "packer_impl.hpp"
+#include "path.hpp"
+#include "projection.hpp"
+#include "record_packer.hpp"
 #include "unpacker.hpp"
+#include "view.hpp"
 
 namespace msgpack {
 namespace lua {
@@ -31,6 +42,7 @@ namespace lua {
  *   pack(object)
  *   packTable(table)
  *   packArray(array)
+ *   packMany(array [, options])
  * }
  */
 int createPacker(lua_State* L) {
@@ -39,8 +51,10 @@ int createPacker(lua_State* L) {
 
 /**
  * class Unpacker {
+ *   Unpacker([feeder] [, options])
  *   feed()
- *   next()
+ *   next([feeder])
+ *   nextView([feeder])
  *   operator () -- equals to next()
  * }
  */
@@ -48,42 +62,150 @@ int createUnpacker(lua_State* L) {
   return Unpacker::create(L);
 }
 
+/**
+ * class View {
+ *   operator [] -- deserializes an element
+ *   operator # -- the number of elements
+ * }
+ */
+int createView(lua_State* L) {
+  return View::create(L);
+}
+
 namespace {
-// TODO: Modify these function to catch std::exception when
-// fixing 'luaL_error with C++' problem.
+/**
+ * @brief Returns the Packer shared by module functions.
+ *
+ * The Packer is created for each lua_State by luaopen_msgpack and is
+ * passed to pack functions as the first upvalue, so that its output
+ * buffer is reused across calls.
+ */
+PackerImpl* defaultPacker(lua_State* L) {
+  return (*static_cast<Packer**>(lua_touserdata(L, lua_upvalueindex(1))))
+    ->packer();
+}
+
 /**
  * @brief pack function which is provided as a module function.
  */
 int pack(lua_State* L) {
-  return DirectPackerImpl().pack(L, 1);
+  return defaultPacker(L)->pack(L, 1);
 }
 
 /**
  * @brief packTable function which is provided as a module function.
  */
 int packTable(lua_State* L) {
-  return DirectPackerImpl().packTable(L, 1);
+  return defaultPacker(L)->packTable(L, 1);
 }
 
 /**
  * @brief packArray function which is provided as a module function.
  */
 int packArray(lua_State* L) {
-  return DirectPackerImpl().packArray(L, 1);
+  return defaultPacker(L)->packArray(L, 1);
+}
+
+/**
+ * @brief packMany function which is provided as a module function.
+ */
+int packMany(lua_State* L) {
+  return defaultPacker(L)->packMany(L, 1);
+}
+
+/**
+ * @brief Returns serialized data passed to unpack functions.
+ *
+ * When multiple strings are passed, they are concatenated. When the last
+ * argument is a table, it is read as options. When it is a Dictionary, it
+ * is used for map keys.
+ *
+ * The projection is parsed after the other arguments are checked, so that
+ * no Lua error is raised while it owns fields. It releases them itself
+ * when it is invalid.
+ *
+ * options:
+ *   fields: the projection applied to deserialized objects
+ *   max_buffer_size, max_elements, max_depth, max_string_length,
+ *   max_objects: limits on deserialized objects (see Limits)
+ *   dictionary: the Dictionary used for map keys
+ */
+const char* checkData(lua_State* L, size_t* size, Projection* projection,
+                      Limits* limits, const Dictionary** dictionary) {
+  int n = lua_gettop(L);
+  bool has_options = false;
+  if (n > 0 && lua_istable(L, n)) {
+    limits->parseOptions(L, n);
+    *dictionary = Dictionary::getOption(L, n);
+    has_options = true;
+  } else if (n > 0 && lua_type(L, n) == LUA_TUSERDATA) {
+    *dictionary = Dictionary::toDictionary(L, n);
+    has_options = *dictionary != NULL;
+  }
+  if (has_options) n--;
+
+  // The size is checked before strings are concatenated.
+  size_t total = 0;
+  for (int i = 1; i <= n; i++) {
+    size_t len;
+    luaL_checklstring(L, i, &len);
+    total += len;
+    if (total < len || total > limits->maxBufferSize()) {
+      luaL_error(L, "deserialization failed: buffer size exceeds the limit");
+    }
+  }
+
+  // Options are moved below data so that the Dictionary is kept alive.
+  if (has_options) {
+    lua_insert(L, 1);
+    if (lua_istable(L, 1)) projection->parseOptions(L, 1);
+  }
+  if (n == 0) {
+    *size = 0;
+    return "";
+  }
+  if (n > 1) lua_concat(L, n);
+  return lua_tolstring(L, -1, size);
 }
 
 /**
  * @brief unpack function which is provided as a module function.
  */
 int unpack(lua_State* L) {
-  Unpacker upk;
-  upk.feed(L, 1); // calling without Unpacker userdata
+  int base;
+  bool failed = false;
+  {
+    Projection projection;
+    Limits limits;
+    const Dictionary* dictionary = NULL;
+    size_t size;
+    const char* data =
+      checkData(L, &size, &projection, &limits, &dictionary);
+    base = lua_gettop(L);
 
-  int res;
-  for (res = 0; upk.next(L); res++) {
-    // TODO: check stack size
+    // deserialize directly from the string
+    try {
+      Decoder decoder(L, projection.given() ? &projection : NULL,
+                      limits.limitsObjects() ? &limits : NULL, dictionary);
+      size_t offset = 0;
+      while (offset < size) {
+        if (!lua_checkstack(L, 1)) {
+          throw msgpack::unpack_error("too many objects");
+        }
+        size_t n = decoder.decode(data + offset, size - offset);
+        if (n == 0) break;
+        offset += n;
+      }
+    } catch (const msgpack::unpack_error& e) {
+      lua_pushfstring(L, "deserialization failed: %s", e.what());
+      failed = true;
+    }
   }
-  return res;
+
+  // The error is raised after the projection and the exception are
+  // destroyed, since lua_error does not unwind them.
+  if (failed) return lua_error(L);
+  return lua_gettop(L) - base;
 }
 
 /**
@@ -93,27 +215,206 @@ int unpack(lua_State* L) {
  * limitation of Lua's stack size.
  */
 int unpackToArray(lua_State* L) {
-  Unpacker upk;
-  upk.feed(L, 1);
+  bool failed = false;
+  {
+    Projection projection;
+    Limits limits;
+    const Dictionary* dictionary = NULL;
+    size_t size;
+    const char* data =
+      checkData(L, &size, &projection, &limits, &dictionary);
 
-  lua_newtable(L);
-  for (int i = 1; upk.next(L); i++) {
-    lua_rawseti(L, -2, i);
+    lua_newtable(L);
+    try {
+      Decoder decoder(L, projection.given() ? &projection : NULL,
+                      limits.limitsObjects() ? &limits : NULL, dictionary);
+      size_t offset = 0;
+      for (int i = 1; offset < size; i++) {
+        size_t n = decoder.decode(data + offset, size - offset);
+        if (n == 0) break;
+        lua_rawseti(L, -2, i);
+        offset += n;
+      }
+    } catch (const msgpack::unpack_error& e) {
+      lua_pushfstring(L, "deserialization failed: %s", e.what());
+      failed = true;
+    }
   }
+
+  if (failed) return lua_error(L);
   return 1;
 }
 
+/**
+ * @brief unpackAt function which is provided as a module function.
+ *
+ * unpackAt(data, pos [, n]) deserializes up to n (default: 1) objects
+ * beginning at the position pos of data, which begins with 1. It returns
+ * the position following the deserialized objects, and then the objects.
+ * Deserialization stops at an incomplete object, and the returned
+ * position points to it.
+ */
+int unpackAt(lua_State* L) {
+  size_t size;
+  const char* data = luaL_checklstring(L, 1, &size);
+  lua_Integer pos = luaL_checkinteger(L, 2);
+  lua_Integer max = luaL_optinteger(L, 3, 1);
+  luaL_argcheck(L, pos >= 1 && static_cast<size_t>(pos - 1) <= size, 2,
+                "position out of range");
+  luaL_argcheck(L, max >= 0, 3, "count must be non-negative");
+  lua_settop(L, 3);
+  lua_pushnil(L); // replaced by the next position
+  int base = lua_gettop(L);
+
+  // deserialize directly from the string
+  size_t offset = static_cast<size_t>(pos - 1);
+  bool failed = false;
+  try {
+    Decoder decoder(L);
+    for (lua_Integer i = 0; i < max && offset < size; i++) {
+      if (!lua_checkstack(L, 1)) {
+        throw msgpack::unpack_error("too many objects");
+      }
+      size_t n = decoder.decode(data + offset, size - offset);
+      if (n == 0) break;
+      offset += n;
+    }
+  } catch (const msgpack::unpack_error& e) {
+    lua_pushfstring(L, "deserialization failed: %s", e.what());
+    failed = true;
+  }
+  if (failed) return lua_error(L);
+
+  lua_pushnumber(L, static_cast<lua_Number>(offset + 1));
+  lua_replace(L, base);
+  return lua_gettop(L) - base + 1;
+}
+
+/**
+ * @brief Skips the object at p.
+ *
+ * @return The end of the object, or NULL with the reason in error when
+ * the object is malformed or incomplete.
+ */
+const char* scanObject(const char* p, const char* end, const char** error) {
+  Header h;
+  h.type = Header::NIL;
+  const char* next = skipObject(p, end, &h);
+  if (next == NULL) {
+    *error = h.type == Header::INVALID ? "invalid type" : "incomplete data";
+  }
+  return next;
+}
+
+/**
+ * @brief validate function which is provided as a module function.
+ *
+ * @return true and the number of objects when data consists of complete
+ * objects. Otherwise, returns false, the reason, and the position of the
+ * object which is malformed or incomplete.
+ */
+int validate(lua_State* L) {
+  size_t size;
+  const char* data = luaL_checklstring(L, 1, &size);
+  const char* end = data + size;
+
+  lua_Number n = 0;
+  for (const char* p = data; p < end; n++) {
+    const char* error;
+    const char* next = scanObject(p, end, &error);
+    if (next == NULL) {
+      lua_pushboolean(L, 0);
+      lua_pushstring(L, error);
+      lua_pushnumber(L, static_cast<lua_Number>(p - data + 1));
+      return 3;
+    }
+    p = next;
+  }
+  lua_pushboolean(L, 1);
+  lua_pushnumber(L, n);
+  return 2;
+}
+
+/**
+ * @brief count function which is provided as a module function.
+ *
+ * @return The number of objects in data. When the 2nd argument is true,
+ * the array of the positions of the objects is also returned. Positions
+ * begin with 1 like those of string.sub.
+ */
+int count(lua_State* L) {
+  size_t size;
+  const char* data = luaL_checklstring(L, 1, &size);
+  const char* end = data + size;
+  bool with_offsets = lua_toboolean(L, 2) != 0;
+  lua_settop(L, 1);
+  if (with_offsets) lua_newtable(L);
+
+  int n = 0;
+  for (const char* p = data; p < end; n++) {
+    const char* error;
+    const char* next = scanObject(p, end, &error);
+    if (next == NULL) {
+      return luaL_error(L, "deserialization failed: %s at %d", error,
+                        static_cast<int>(p - data + 1));
+    }
+    if (with_offsets) {
+      lua_pushnumber(L, static_cast<lua_Number>(p - data + 1));
+      lua_rawseti(L, 2, n + 1);
+    }
+    p = next;
+  }
+
+  lua_pushnumber(L, n);
+  if (with_offsets) lua_insert(L, 2);
+  return with_offsets ? 2 : 1;
+}
+
 const char* const MpLuaPkgName = "msgpack";
 const struct luaL_Reg MpLuaLib[] = {
   {"Packer", &createPacker},
-  {"pack", &pack},
-  {"packTable", &packTable},
-  {"packArray", &packArray},
   {"Unpacker", &createUnpacker},
   {"unpack", &unpack},
   {"unpackToArray", &unpackToArray},
+  {"unpackAt", &unpackAt},
+  {"validate", &validate},
+  {"count", &count},
+  {"open", &FileReader::create},
+  {"view", &createView},
+  {"unpackView", &View::unpack},
+  {"pairs", &View::pairs},
+  {"get", &Path::get},
+  {"path", &Path::compile},
+  {"compile", &RecordPacker::create},
+  {"numbers", &NumericArray::mark},
+  {"packNumbers", &NumericArray::packNumbers},
+  {"Dictionary", &Dictionary::create},
+  {"registerExt", &ExtRegistry::registerExt},
+  {"registerClass", &ExtRegistry::registerClass},
+  {NULL, NULL}
+};
+
+// functions sharing the default Packer as an upvalue
+const struct luaL_Reg MpLuaPackLib[] = {
+  {"pack", &pack},
+  {"packTable", &packTable},
+  {"packArray", &packArray},
+  {"packMany", &packMany},
   {NULL, NULL}
 };
+
+/**
+ * @brief Registers functions in MpLuaPackLib to the table on the top.
+ */
+void registerPackFunctions(lua_State* L) {
+  Packer::push(L, new DirectPackerImpl());
+  for (const luaL_Reg* r = MpLuaPackLib; r->name != NULL; r++) {
+    lua_pushvalue(L, -1);
+    lua_pushcclosure(L, r->func, 1);
+    lua_setfield(L, -3, r->name);
+  }
+  lua_pop(L, 1);
+}
 } // namespace
 } // namespace lua
 } // namespace msgpack
@@ -126,7 +427,14 @@ extern "C" {
   int luaopen_msgpack(lua_State* L) {
     msgpack::lua::Packer::registerUserdata(L);
     msgpack::lua::Unpacker::registerUserdata(L);
+    msgpack::lua::View::registerUserdata(L);
+    msgpack::lua::FileReader::registerUserdata(L);
+    msgpack::lua::RecordPacker::registerUserdata(L);
+    msgpack::lua::Dictionary::registerUserdata(L);
+    msgpack::lua::ExtRegistry::registerUserdata(L);
+    msgpack::lua::NumericArray::registerMetatables(L);
     luaL_register(L, msgpack::lua::MpLuaPkgName, msgpack::lua::MpLuaLib);
+    msgpack::lua::registerPackFunctions(L);
     return 1;
   }
 }
@@ -0,0 +1,252 @@
+/*
+ * MessagePack for Lua
+ *
+ * Copyright (C) 2010 Nobuyuki Kubota
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "numeric_array.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <string>
+#include "format.hpp"
+#include "pack_error.hpp"
+
+namespace msgpack {
+namespace lua {
+namespace {
+const char* const TypeNames[] = {"float64", "int32", "int64"};
+const char* const MetatablePrefix = "msgpack.numbers.";
+
+// The number of elements converted at once.
+const size_t ChunkSize = 512;
+
+/**
+ * @brief Converts numbers into big endian.
+ *
+ * @return false when a number cannot be represented by the type.
+ */
+bool encode(const double* v, size_t n, NumericArray::Type type, char* out) {
+  bool ok = true;
+  switch (type) {
+  case NumericArray::FLOAT64:
+    for (size_t i = 0; i < n; i++) {
+      uint64_t bits;
+      memcpy(&bits, &v[i], sizeof(bits));
+      storeBigEndian64(out + i * 8, bits);
+    }
+    break;
+
+  case NumericArray::INT32:
+    // Ranges are checked before casting, which is undefined otherwise.
+    for (size_t i = 0; i < n; i++) {
+      ok &= v[i] >= -2147483648.0 && v[i] <= 2147483647.0;
+    }
+    if (!ok) return false;
+    for (size_t i = 0; i < n; i++) {
+      int32_t x = static_cast<int32_t>(v[i]);
+      ok &= x == v[i];
+      storeBigEndian32(out + i * 4, static_cast<uint32_t>(x));
+    }
+    break;
+
+  case NumericArray::INT64:
+    for (size_t i = 0; i < n; i++) {
+      ok &= v[i] >= -9223372036854775808.0 && v[i] < 9223372036854775808.0;
+    }
+    if (!ok) return false;
+    for (size_t i = 0; i < n; i++) {
+      int64_t x = static_cast<int64_t>(v[i]);
+      ok &= x == v[i];
+      storeBigEndian64(out + i * 8, static_cast<uint64_t>(x));
+    }
+    break;
+  }
+  return ok;
+}
+
+/**
+ * @brief Converts numbers in big endian into doubles.
+ */
+void decode(const char* p, size_t n, NumericArray::Type type, double* out) {
+  switch (type) {
+  case NumericArray::FLOAT64:
+    for (size_t i = 0; i < n; i++) {
+      uint64_t bits = loadBigEndian64(p + i * 8);
+      memcpy(&out[i], &bits, sizeof(bits));
+    }
+    break;
+
+  case NumericArray::INT32:
+    for (size_t i = 0; i < n; i++) {
+      out[i] = static_cast<int32_t>(loadBigEndian32(p + i * 4));
+    }
+    break;
+
+  case NumericArray::INT64:
+    for (size_t i = 0; i < n; i++) {
+      out[i] = static_cast<double>(
+        static_cast<int64_t>(loadBigEndian64(p + i * 8)));
+    }
+    break;
+  }
+}
+} // namespace
+
+const int8_t NumericArray::FirstExtType;
+const char* const NumericArray::MarkerField = "__msgpack_numbers";
+
+void NumericArray::registerMetatables(lua_State* L) {
+  for (int i = FLOAT64; i <= INT64; i++) {
+    std::string name = std::string(MetatablePrefix) + TypeNames[i];
+    if (luaL_newmetatable(L, name.c_str()) != 0) {
+      lua_pushstring(L, TypeNames[i]);
+      lua_setfield(L, -2, MarkerField);
+    }
+    lua_pop(L, 1);
+  }
+}
+
+int NumericArray::mark(lua_State* L) {
+  luaL_checktype(L, 1, LUA_TTABLE);
+  const char* name = luaL_optstring(L, 2, TypeNames[FLOAT64]);
+  Type type;
+  luaL_argcheck(L, toType(name, &type), 2, "invalid numeric type");
+
+  std::string metatable = std::string(MetatablePrefix) + TypeNames[type];
+  luaL_getmetatable(L, metatable.c_str());
+  lua_setmetatable(L, 1);
+  lua_settop(L, 1);
+  return 1;
+}
+
+int NumericArray::packNumbers(lua_State* L) {
+  luaL_checktype(L, 1, LUA_TTABLE);
+  const char* name = luaL_optstring(L, 2, TypeNames[FLOAT64]);
+  Type type;
+  luaL_argcheck(L, toType(name, &type), 2, "invalid numeric type");
+
+  {
+    msgpack::sbuffer buffer;
+    try {
+      pack(L, 1, type, buffer);
+      lua_pushlstring(L, buffer.data(), buffer.size());
+      return 1;
+    } catch (const PackError& e) {
+      lua_settop(L, 2);
+      lua_pushstring(L, e.what());
+    }
+  }
+  // raised after the buffer is released
+  return lua_error(L);
+}
+
+bool NumericArray::marked(lua_State* L, int index, Type* type) {
+  if (!lua_getmetatable(L, index)) return false;
+  lua_getfield(L, -1, MarkerField);
+  bool res = lua_type(L, -1) == LUA_TSTRING &&
+    toType(lua_tostring(L, -1), type);
+  lua_pop(L, 2);
+  return res;
+}
+
+void NumericArray::pack(lua_State* L, int index, Type type,
+                        msgpack::sbuffer& buffer) {
+  size_t n = lua_objlen(L, index);
+  size_t w = width(type);
+  uint64_t size = static_cast<uint64_t>(n) * w;
+  if (size > 0xffffffffu) {
+    throwPackError(L, "numeric array is too large");
+  }
+
+  char header[6];
+  size_t header_size;
+  if (size < 256) {
+    header[0] = '\xc7'; // ext 8
+    header_size = 3;
+  } else if (size < 65536) {
+    header[0] = '\xc8'; // ext 16
+    header_size = 4;
+  } else {
+    header[0] = '\xc9'; // ext 32
+    header_size = 6;
+  }
+  storeBigEndian(header + 1, size, header_size - 2);
+  header[header_size - 1] = static_cast<char>(FirstExtType + type);
+  buffer.write(header, header_size);
+
+  double values[ChunkSize];
+  char out[ChunkSize * 8];
+  for (size_t i = 0; i < n; i += ChunkSize) {
+    size_t m = std::min(ChunkSize, n - i);
+    for (size_t j = 0; j < m; j++) {
+      lua_rawgeti(L, index, static_cast<int>(i + j + 1));
+      if (lua_type(L, -1) != LUA_TNUMBER) {
+        throwPackError(L, "numeric array has a non-number at %d",
+                       static_cast<int>(i + j + 1));
+      }
+      values[j] = lua_tonumber(L, -1);
+      lua_pop(L, 1);
+    }
+    if (!encode(values, m, type, out)) {
+      throwPackError(L,
+                     "numeric array has a number out of the range of %s",
+                     TypeNames[type]);
+    }
+    buffer.write(out, m * w);
+  }
+}
+
+bool NumericArray::unpack(lua_State* L, int8_t ext_type, const char* payload,
+                          size_t size) {
+  if (ext_type < FirstExtType || ext_type > FirstExtType + INT64) {
+    return false;
+  }
+  Type type = static_cast<Type>(ext_type - FirstExtType);
+  size_t w = width(type);
+  if (size % w != 0) {
+    throw msgpack::unpack_error("invalid numeric array");
+  }
+
+  size_t n = size / w;
+  lua_createtable(L, static_cast<int>(n), 0);
+  double values[ChunkSize];
+  for (size_t i = 0; i < n; i += ChunkSize) {
+    size_t m = std::min(ChunkSize, n - i);
+    decode(payload + i * w, m, type, values);
+    for (size_t j = 0; j < m; j++) {
+      lua_pushnumber(L, values[j]);
+      lua_rawseti(L, -2, static_cast<int>(i + j + 1));
+    }
+  }
+  return true;
+}
+
+bool NumericArray::toType(const char* name, Type* type) {
+  for (int i = FLOAT64; i <= INT64; i++) {
+    if (strcmp(name, TypeNames[i]) == 0) {
+      *type = static_cast<Type>(i);
+      return true;
+    }
+  }
+  return false;
+}
+
+size_t NumericArray::width(Type type) {
+  return type == INT32 ? 4 : 8;
+}
+
+} // namespace lua
+} // namespace msgpack
@@ -0,0 +1,110 @@
+/*
+ * MessagePack for Lua
+ *
+ * Copyright (C) 2010 Nobuyuki Kubota
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef MSGPACK_LUA_NUMERIC_ARRAY_HPP_
+#define MSGPACK_LUA_NUMERIC_ARRAY_HPP_
+
+#include <lua.hpp>
+#include <msgpack.hpp>
+
+namespace msgpack {
+namespace lua {
+
+/**
+ * @brief Array of numbers serialized as a single ext object.
+ *
+ * The payload of the ext object is the sequence of the numbers in big
+ * endian, either as float64, int32 or int64. The ext type tells which.
+ *
+ * Usage:
+ * -- pack t as a numeric array whenever it is packed
+ * msgpack.numbers(t [, "float64" | "int32" | "int64"])
+ * -- pack t as a numeric array only this time
+ * data = msgpack.packNumbers(t [, type])
+ *
+ * A table is packed as a numeric array when its metatable has the field
+ * __msgpack_numbers whose value is the name of the type.
+ */
+class NumericArray {
+public:
+  enum Type {
+    FLOAT64,
+    INT32,
+    INT64
+  };
+
+  // Ext types of FLOAT64, INT32 and INT64 in this order.
+  static const int8_t FirstExtType = 0x10;
+
+  static const char* const MarkerField;
+
+  /**
+   * @brief Creates metatables set by numbers.
+   */
+  static void registerMetatables(lua_State* L);
+
+  /**
+   * @brief Sets the metatable of the given table so that it is packed as
+   * a numeric array.
+   */
+  static int mark(lua_State* L);
+
+  /**
+   * @brief Packs the given table as a numeric array.
+   */
+  static int packNumbers(lua_State* L);
+
+  /**
+   * @brief Returns the type for which the table at the given index is
+   * marked.
+   *
+   * @return false when the table is not marked.
+   */
+  static bool marked(lua_State* L, int index, Type* type);
+
+  /**
+   * @brief Appends the array at the given index to the buffer.
+   *
+   * Numbers are read, checked and converted in chunks so that each step
+   * runs in a tight loop over contiguous memory.
+   *
+   * @throw PackError when the array has a number out of the range of the
+   * type or a value other than a number.
+   */
+  static void pack(lua_State* L, int index, Type type,
+                   msgpack::sbuffer& buffer);
+
+  /**
+   * @brief Pushes the array deserialized from the payload of an ext object.
+   *
+   * @return false when the ext type is not of a numeric array.
+   *
+   * @throw msgpack::unpack_error when the payload is malformed.
+   */
+  static bool unpack(lua_State* L, int8_t ext_type, const char* payload,
+                     size_t size);
+
+private:
+  static bool toType(const char* name, Type* type);
+  static size_t width(Type type);
+};
+
+} // namespace lua
+} // namespace msgpack
+
+#endif
@@ -0,0 +1,69 @@
+/*
+ * MessagePack for Lua
+ *
+ * Copyright (C) 2010 Nobuyuki Kubota
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef MSGPACK_LUA_OPTIONS_HPP_
+#define MSGPACK_LUA_OPTIONS_HPP_
+
+#include <cstddef>
+#include <lua.hpp>
+
+namespace msgpack {
+namespace lua {
+
+/**
+ * @brief Gets a size option from the table at the given index.
+ *
+ * A size beyond the range of size_t, such as math.huge, is clamped to the
+ * maximum, which means no limit. NaN is rejected.
+ */
+inline size_t getSizeOption(lua_State* L, int index, const char* name,
+                            size_t def) {
+  lua_getfield(L, index, name);
+  if (lua_isnil(L, -1)) {
+    lua_pop(L, 1);
+    return def;
+  }
+
+  lua_Number n = lua_tonumber(L, -1);
+  if (!lua_isnumber(L, -1) || !(n >= 0)) {
+    luaL_error(L, "option '%s' must be a non-negative number", name);
+  }
+  lua_pop(L, 1);
+
+  // The maximum is rounded up to 2^64 as a lua_Number when size_t has 64
+  // bits, and is exact otherwise, so every number below it fits in size_t.
+  const size_t max = static_cast<size_t>(-1);
+  if (n >= static_cast<lua_Number>(max)) return max;
+  return static_cast<size_t>(n);
+}
+
+/**
+ * @brief Gets a boolean option from the table at the given index.
+ */
+inline bool getBooleanOption(lua_State* L, int index, const char* name,
+                             bool def) {
+  lua_getfield(L, index, name);
+  bool b = lua_isnil(L, -1) ? def : lua_toboolean(L, -1) != 0;
+  lua_pop(L, 1);
+  return b;
+}
+
+} // namespace lua
+} // namespace msgpack
+
+#endif
@@ -0,0 +1,71 @@
+/*
+ * MessagePack for Lua
+ *
+ * Copyright (C) 2010 Nobuyuki Kubota
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef MSGPACK_LUA_PACK_ERROR_HPP_
+#define MSGPACK_LUA_PACK_ERROR_HPP_
+
+#include <cstdarg>
+#include <stdexcept>
+#include <string>
+#include <lua.hpp>
+
+namespace msgpack {
+namespace lua {
+
+/**
+ * @brief Error while packing values.
+ *
+ * Packing code throws PackError instead of raising a Lua error, which
+ * would jump over the destructors of C++ objects such as buffers and
+ * frames of nested tables. The function called from Lua catches it and
+ * raises the Lua error after releasing them.
+ */
+class PackError : public std::runtime_error {
+public:
+  explicit PackError(const std::string& message)
+    : std::runtime_error(message) {}
+};
+
+/**
+ * @brief Throws a PackError having the message formatted by
+ * lua_pushfstring.
+ */
+inline void throwPackError(lua_State* L, const char* fmt, ...) {
+  va_list args;
+  va_start(args, fmt);
+  std::string message = lua_pushvfstring(L, fmt, args);
+  va_end(args);
+  lua_pop(L, 1);
+  throw PackError(message);
+}
+
+/**
+ * @brief Throws a PackError having the error value on the top of the
+ * stack, which is popped, e.g. the error of lua_pcall.
+ */
+inline void throwPackError(lua_State* L) {
+  const char* s = lua_tostring(L, -1);
+  std::string message = s != NULL ? s : "(error object is not a string)";
+  lua_pop(L, 1);
+  throw PackError(message);
+}
+
+} // namespace lua
+} // namespace msgpack
+
+#endif
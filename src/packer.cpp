@@ -19,8 +19,18 @@
 #include "packer.hpp"
 
 #include <cassert>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include "dictionary.hpp"
+#include "options.hpp"
 #include "packer_impl.hpp"
 
+// Descriptors are not inherited by executed programs where supported.
+#ifndef O_CLOEXEC
+#define O_CLOEXEC 0
+#endif
+
 // TODO: check error codes of msgpack
 
 namespace msgpack {
@@ -55,6 +65,9 @@ void Packer::registerUserdata(lua_State* L) {
     {"pack", &packerProxy<&Packer::pack>},
     {"packTable", &packerProxy<&Packer::packTable>},
     {"packArray", &packerProxy<&Packer::packArray>},
+    {"packMany", &packerProxy<&Packer::packMany>},
+    {"flush", &packerProxy<&Packer::flush>},
+    {"close", &packerProxy<&Packer::close>},
     {NULL, NULL}
   };
   luaL_register(L, NULL, Methods);
@@ -62,19 +75,99 @@ void Packer::registerUserdata(lua_State* L) {
 }
 
 int Packer::create(lua_State* L) {
-  // TODO: check the argument of constructor
-  // TODO: Create StreamPackerImpl if stack[1] == function
+  int callback = 0;
+  int options = 1;
+  if (lua_isfunction(L, 1)) {
+    callback = 1;
+    options = 2;
+  }
+
+  // options:
+  //   retain_size: the maximum capacity of the buffer kept between calls
+  //   flush_bytes: the size of buffered data to call the callback or to
+  //                write to the file
+  //   flush_records: the number of buffered objects to write to the file
+  //   fd: the file descriptor to write to
+  //   path: the path of the file to append to
+  //   max_depth: the maximum depth of nested tables
+  //   dedup: packs shared tables and repeated strings as references
+  //   dictionary: the Dictionary used for map keys
+  size_t retain_size = BufferPool::DefaultRetainSize;
+  size_t flush_size = StreamPackerImpl::DefaultFlushSize;
+  size_t flush_count = 0;
+  size_t max_depth = static_cast<size_t>(-1);
+  bool dedup = false;
+  int dictionary = 0;
+  int fd = -1;
+  const char* path = NULL;
+  if (!lua_isnoneornil(L, options)) {
+    luaL_checktype(L, options, LUA_TTABLE);
+    retain_size = getSizeOption(L, options, "retain_size", retain_size);
+    flush_size = getSizeOption(L, options, "flush_bytes", flush_size);
+    flush_count = getSizeOption(L, options, "flush_records", flush_count);
+    max_depth = getSizeOption(L, options, "max_depth", max_depth);
+    dedup = getBooleanOption(L, options, "dedup", dedup);
+    if (Dictionary::getOption(L, options) != NULL) {
+      lua_getfield(L, options, "dictionary");
+      dictionary = lua_gettop(L);
+    }
+
+    lua_getfield(L, options, "fd");
+    if (!lua_isnil(L, -1)) {
+      if (!lua_isnumber(L, -1) || lua_tonumber(L, -1) < 0) {
+        luaL_error(L, "option 'fd' must be a file descriptor");
+      }
+      fd = static_cast<int>(lua_tonumber(L, -1));
+    }
+    lua_getfield(L, options, "path");
+    if (!lua_isnil(L, -1)) {
+      if (lua_type(L, -1) != LUA_TSTRING) {
+        luaL_error(L, "option 'path' must be a string");
+      }
+      path = lua_tostring(L, -1);
+    }
+    // Values are kept on the stack so that path remains valid.
+  }
+
+  PackerImpl* impl;
+  if (fd >= 0 || path != NULL) {
+    if (callback != 0 || (fd >= 0 && path != NULL)) {
+      return luaL_error(L, "only one of callback, fd and path can be given");
+    }
+
+    bool owns_fd = fd < 0;
+    if (owns_fd) {
+      fd = open(path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0666);
+      if (fd < 0) return luaL_error(L, "%s: %s", path, strerror(errno));
+    }
+    impl = new FilePackerImpl(fd, owns_fd, flush_size, flush_count,
+                              retain_size);
+  } else if (callback == 0) {
+    impl = new DirectPackerImpl(retain_size);
+  } else {
+    lua_pushvalue(L, callback);
+    int ref = luaL_ref(L, LUA_REGISTRYINDEX);
+    impl = new StreamPackerImpl(ref, flush_size, retain_size);
+  }
+  impl->setMaxDepth(max_depth);
+  impl->setDedup(dedup);
+  if (dictionary != 0) impl->setDictionary(L, dictionary);
+  push(L, impl);
+  return 1;
+}
 
+void Packer::push(lua_State* L, PackerImpl* packer) {
   Packer** p = static_cast<Packer**>(lua_newuserdata(L, sizeof(Packer*)));
   luaL_getmetatable(L, Packer::MetatableName);
   lua_setmetatable(L, -2);
-  *p = new Packer(new DirectPackerImpl());
-  return 1;
+  *p = new Packer(packer);
 }
 
 int Packer::finalizer(lua_State* L) {
   Packer* p =
     *static_cast<Packer**>(luaL_checkudata(L, 1, Packer::MetatableName));
+  p->packer()->finalize(L);
+  p->packer()->releaseDictionary(L);
   delete p;
   return 0;
 }
@@ -99,5 +192,17 @@ int Packer::packArray(lua_State* L) {
   return packer_->packArray(L, 2);
 }
 
+int Packer::packMany(lua_State* L) {
+  return packer_->packMany(L, 2);
+}
+
+int Packer::flush(lua_State* L) {
+  return packer_->flush(L);
+}
+
+int Packer::close(lua_State* L) {
+  return packer_->close(L);
+}
+
 } // namespace lua
 } // namespace msgpack
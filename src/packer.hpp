@@ -30,6 +30,30 @@ class PackerImpl;
 /**
  * Metatable for this class:
  * callback = nil or function (serialized string)
+ *
+ * Usage:
+ * p = msgpack.Packer([options])
+ * p = msgpack.Packer(callback [, options])
+ *
+ * Without callback, pack functions return serialized data. Otherwise,
+ * serialized data is buffered and passed to the callback when the buffer
+ * has options.flush_bytes or more bytes, or flush is called.
+ *
+ * When options.fd or options.path is given, serialized data is buffered
+ * and written to the file descriptor or the file opened for appending.
+ * It is written when the buffer has options.flush_bytes or more bytes,
+ * options.flush_records or more objects, or flush or close is called.
+ * close closes the file only if it was opened by path.
+ *
+ * Packing a table containing itself raises an error, and so does packing
+ * tables nested deeper than options.max_depth.
+ *
+ * When options.dedup is true, each argument is packed with shared tables
+ * and repeated strings as references to their first occurrences, and a
+ * table containing itself can be packed. See SharedReferences.
+ *
+ * When options.dictionary is given, map keys are packed with the
+ * Dictionary. See Dictionary.
  */
 class Packer {
 private:
@@ -41,6 +65,11 @@ public:
   static void registerUserdata(lua_State* L);
   static int create(lua_State* L);
 
+  /**
+   * @brief Pushes a new Packer userdata which owns the given PackerImpl.
+   */
+  static void push(lua_State* L, PackerImpl* packer);
+
 private:
   static int finalizer(lua_State* L);
 
@@ -81,6 +110,28 @@ public:
    */
   int packArray(lua_State* L);
 
+  /**
+   * @brief Pack each element of an array.
+   *
+   * This function packs elements as if they were passed to pack one by
+   * one, in a single call.
+   */
+  int packMany(lua_State* L);
+
+  /**
+   * @brief Flush buffered data.
+   *
+   * This function does nothing when the Packer has no callback.
+   */
+  int flush(lua_State* L);
+
+  /**
+   * @brief Flush buffered data and close the file.
+   *
+   * This function is the same as flush unless the Packer writes to a file.
+   */
+  int close(lua_State* L);
+
   PackerImpl* packer() { return packer_; }
   const PackerImpl* packer() const { return packer_; }
 
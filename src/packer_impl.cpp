@@ -18,40 +18,300 @@
 
 #include "packer_impl.hpp"
 
+#include <cerrno>
+#include <cstring>
+#include <unistd.h>
+#include "buffer_packer.hpp"
+#include "dictionary.hpp"
 #include "lua_objects.hpp"
+#include "options.hpp"
+#include "pack_error.hpp"
 
 namespace msgpack {
 namespace lua {
+namespace {
+/**
+ * @brief Operations of packWith. Each serializes the arguments from
+ * arg_base in its way and returns the number of serialized objects.
+ */
+struct PackArguments {
+  int operator ()(lua_State* L, int arg_base, LuaObjects& obj,
+                  BufferPacker& pk) const {
+    obj.msgpack_pack(pk);
+    return lua_gettop(L) - arg_base + 1;
+  }
+};
 
-int DirectPackerImpl::pack(lua_State* L, int arg_base) {
-  sbuffer buffer;
-  packer<sbuffer> pk(&buffer);
-  LuaObjects obj(L, arg_base);
+struct PackTables {
+  int operator ()(lua_State* L, int arg_base, LuaObjects& obj,
+                  BufferPacker& pk) const {
+    obj.packTable(pk);
+    return lua_gettop(L) - arg_base + 1;
+  }
+};
 
-  obj.msgpack_pack(pk);
-  lua_pushlstring(L, buffer.data(), buffer.size());
-  return 1;
+struct PackArrays {
+  int operator ()(lua_State* L, int arg_base, LuaObjects& obj,
+                  BufferPacker& pk) const {
+    obj.packArray(pk);
+    return lua_gettop(L) - arg_base + 1;
+  }
+};
+
+struct PackElements {
+  PackElements(bool length_prefix, int ends, const Dictionary* dictionary)
+    : length_prefix(length_prefix), ends(ends), dictionary(dictionary) {}
+
+  int operator ()(lua_State* L, int arg_base, LuaObjects& obj,
+                  BufferPacker& pk) const {
+    if (dictionary != NULL) obj.setDictionary(dictionary);
+    obj.packElements(pk, length_prefix, ends);
+    return static_cast<int>(lua_objlen(L, arg_base));
+  }
+
+  bool length_prefix;
+  int ends;
+  const Dictionary* dictionary;
+};
+} // namespace
+
+void PackerImpl::configure(LuaObjects& obj) const {
+  obj.setMaxDepth(max_depth_);
+  obj.setDedup(dedup_);
+  obj.setDictionary(dictionary_);
 }
 
-int DirectPackerImpl::packTable(lua_State* L, int arg_base) {
-  sbuffer buffer;
-  packer<sbuffer> pk(&buffer);
-  LuaObjects obj(L, arg_base);
+void PackerImpl::parseManyOptions(lua_State* L, int arg_base,
+                                  bool* length_prefix, bool* offsets,
+                                  const Dictionary** dictionary) {
+  luaL_checktype(L, arg_base, LUA_TTABLE);
+  *length_prefix = false;
+  *offsets = false;
+  *dictionary = NULL;
+  int options = arg_base + 1;
+  if (lua_isnoneornil(L, options)) return;
+  if (lua_type(L, options) == LUA_TUSERDATA) {
+    *dictionary = Dictionary::toDictionary(L, options);
+    if (*dictionary != NULL) return;
+  }
+  luaL_checktype(L, options, LUA_TTABLE);
+  *length_prefix = getBooleanOption(L, options, "length_prefix", false);
+  *offsets = getBooleanOption(L, options, "offsets", false);
+  *dictionary = Dictionary::getOption(L, options);
+}
 
-  obj.packTable(pk);
-  lua_pushlstring(L, buffer.data(), buffer.size());
-  return 1;
+void PackerImpl::setDictionary(lua_State* L, int index) {
+  releaseDictionary(L);
+  dictionary_ = Dictionary::toDictionary(L, index);
+  lua_pushvalue(L, index);
+  dictionary_ref_ = luaL_ref(L, LUA_REGISTRYINDEX);
 }
 
-int DirectPackerImpl::packArray(lua_State* L, int arg_base) {
-  sbuffer buffer;
-  packer<sbuffer> pk(&buffer);
-  LuaObjects obj(L, arg_base);
+void PackerImpl::releaseDictionary(lua_State* L) {
+  luaL_unref(L, LUA_REGISTRYINDEX, dictionary_ref_);
+  dictionary_ = NULL;
+  dictionary_ref_ = LUA_NOREF;
+}
+
+template<typename Operation>
+int PackerImpl::packWith(lua_State* L, int arg_base, const Operation& op) {
+  size_t offset;
+  msgpack::sbuffer* buffer = beginPack(L, &offset);
+  int top = lua_gettop(L);
+  int count = 0;
+  bool failed = false;
+  try {
+    BufferPacker pk(*buffer);
+    LuaObjects obj(L, arg_base);
+    configure(obj);
+
+    pk.rewind(offset);
+    count = op(L, arg_base, obj, pk);
+  } catch (const PackError& e) {
+    abortPack(buffer);
+    lua_settop(L, top);
+    lua_pushstring(L, e.what());
+    failed = true;
+  }
+
+  // The error is raised after the C++ objects of packing are destroyed,
+  // since lua_error does not unwind them.
+  if (failed) return lua_error(L);
+  return endPack(L, buffer, count);
+}
+
+int PackerImpl::pack(lua_State* L, int arg_base) {
+  return packWith(L, arg_base, PackArguments());
+}
 
-  obj.packArray(pk);
-  lua_pushlstring(L, buffer.data(), buffer.size());
+int PackerImpl::packTable(lua_State* L, int arg_base) {
+  return packWith(L, arg_base, PackTables());
+}
+
+int PackerImpl::packArray(lua_State* L, int arg_base) {
+  return packWith(L, arg_base, PackArrays());
+}
+
+int PackerImpl::packMany(lua_State* L, int arg_base) {
+  bool length_prefix, offsets;
+  const Dictionary* dictionary;
+  parseManyOptions(L, arg_base, &length_prefix, &offsets, &dictionary);
+  if (offsets && !supportsOffsets()) {
+    return luaL_error(L, "option 'offsets' requires a Packer returning data");
+  }
+
+  // The options, which keep the Dictionary alive, are the last argument.
+  lua_settop(L, arg_base + 1);
+  if (!offsets) {
+    return packWith(L, arg_base, PackElements(length_prefix, 0, dictionary));
+  }
+
+  lua_createtable(L, static_cast<int>(lua_objlen(L, arg_base)), 0);
+  int ends = lua_gettop(L);
+  int n = packWith(L, arg_base, PackElements(length_prefix, ends,
+                                             dictionary));
+  lua_pushvalue(L, ends);
+  return n + 1;
+}
+
+msgpack::sbuffer* DirectPackerImpl::beginPack(lua_State* L, size_t* offset) {
+  *offset = 0;
+  return pool_.acquire();
+}
+
+void DirectPackerImpl::abortPack(msgpack::sbuffer* buffer) {
+  pool_.release(buffer);
+}
+
+int DirectPackerImpl::endPack(lua_State* L, msgpack::sbuffer* buffer,
+                              int count) {
+  lua_pushlstring(L, buffer->data(), buffer->size());
+  pool_.release(buffer);
   return 1;
 }
 
+StreamPackerImpl::StreamPackerImpl(int callback, size_t flush_size,
+                                   size_t retain_size)
+  : callback_(callback), flush_size_(flush_size), pool_(retain_size),
+    buffer_(pool_.acquire()), committed_(0) {
+}
+
+StreamPackerImpl::~StreamPackerImpl() {
+  pool_.release(buffer_);
+}
+
+msgpack::sbuffer* StreamPackerImpl::beginPack(lua_State* L, size_t* offset) {
+  *offset = committed_;
+  return buffer_;
+}
+
+int StreamPackerImpl::endPack(lua_State* L, msgpack::sbuffer* buffer,
+                              int count) {
+  committed_ = buffer_->size();
+  if (committed_ >= flush_size_) return flush(L);
+  return 0;
+}
+
+int StreamPackerImpl::flush(lua_State* L) {
+  if (committed_ == 0) return 0;
+
+  lua_rawgeti(L, LUA_REGISTRYINDEX, callback_);
+  lua_pushlstring(L, buffer_->data(), committed_);
+
+  // The buffer is emptied before calling the callback so that the data
+  // is never passed twice even if the callback fails or packs data.
+  pool_.release(buffer_);
+  buffer_ = pool_.acquire();
+  committed_ = 0;
+
+  lua_call(L, 1, 0);
+  return 0;
+}
+
+void StreamPackerImpl::finalize(lua_State* L) {
+  luaL_unref(L, LUA_REGISTRYINDEX, callback_);
+  callback_ = LUA_NOREF;
+}
+
+FilePackerImpl::FilePackerImpl(int fd, bool owns_fd, size_t flush_size,
+                               size_t flush_count, size_t retain_size)
+  : fd_(fd), owns_fd_(owns_fd), flush_size_(flush_size),
+    flush_count_(flush_count), pool_(retain_size),
+    buffer_(pool_.acquire()), committed_(0), count_(0) {
+}
+
+FilePackerImpl::~FilePackerImpl() {
+  pool_.release(buffer_);
+}
+
+msgpack::sbuffer* FilePackerImpl::beginPack(lua_State* L, size_t* offset) {
+  checkOpen(L);
+  *offset = committed_;
+  return buffer_;
+}
+
+int FilePackerImpl::endPack(lua_State* L, msgpack::sbuffer* buffer,
+                            int count) {
+  committed_ = buffer_->size();
+  if (count > 0) count_ += count;
+  if (committed_ >= flush_size_ ||
+      (flush_count_ > 0 && count_ >= flush_count_)) {
+    return flush(L);
+  }
+  return 0;
+}
+
+int FilePackerImpl::flush(lua_State* L) {
+  checkOpen(L);
+  int err = writeBuffer();
+  if (err != 0) luaL_error(L, "write failed: %s", strerror(err));
+  return 0;
+}
+
+int FilePackerImpl::close(lua_State* L) {
+  if (fd_ < 0) return 0;
+  int err = writeBuffer();
+  if (owns_fd_ && ::close(fd_) != 0 && err == 0) err = errno;
+  fd_ = -1;
+  if (err != 0) luaL_error(L, "write failed: %s", strerror(err));
+  return 0;
+}
+
+void FilePackerImpl::finalize(lua_State* L) {
+  // Errors cannot be reported from __gc.
+  if (fd_ < 0) return;
+  writeBuffer();
+  if (owns_fd_) ::close(fd_);
+  fd_ = -1;
+}
+
+void FilePackerImpl::checkOpen(lua_State* L) const {
+  if (fd_ < 0) luaL_error(L, "attempt to use a closed Packer");
+}
+
+int FilePackerImpl::writeBuffer() {
+  const char* p = buffer_->data();
+  size_t size = committed_;
+  int err = 0;
+  while (size > 0) {
+    ssize_t n = write(fd_, p, size);
+    if (n < 0) {
+      if (errno == EINTR) continue;
+      err = errno;
+      break;
+    }
+    p += n;
+    size -= n;
+  }
+
+  // Data not written because of an error is discarded as well, so that
+  // it is never written twice.
+  pool_.release(buffer_);
+  buffer_ = pool_.acquire();
+  committed_ = 0;
+  count_ = 0;
+  return err;
+}
+
 } // namespace lua
 } // namespace msgpack
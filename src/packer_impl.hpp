@@ -25,63 +25,387 @@
 namespace msgpack {
 namespace lua {
 
+class BufferPacker;
+class Dictionary;
+class LuaObjects;
+
+/**
+ * @brief Keeps an sbuffer to be reused by successive pack calls.
+ *
+ * A buffer is handed out by acquire and is returned by release. Since a
+ * pack call can be nested (e.g. packing in a function called while
+ * packing), a new buffer is created when the retained one is in use.
+ * A buffer grown larger than retain_size is freed instead of retained.
+ */
+class BufferPool {
+private:
+  BufferPool(const BufferPool&);
+  BufferPool& operator =(const BufferPool&);
+
+public:
+  static const size_t DefaultRetainSize = 1024 * 1024;
+
+  explicit BufferPool(size_t retain_size = DefaultRetainSize)
+    : buffer_(NULL), retain_size_(retain_size) {}
+  ~BufferPool() { delete buffer_; }
+
+  /**
+   * @brief Returns an empty buffer.
+   */
+  msgpack::sbuffer* acquire() {
+    msgpack::sbuffer* b = buffer_;
+    if (b == NULL) return new msgpack::sbuffer();
+    buffer_ = NULL;
+    b->clear();
+    return b;
+  }
+
+  /**
+   * @brief Gives back the buffer returned by acquire.
+   */
+  void release(msgpack::sbuffer* b) {
+    if (buffer_ != NULL || b->alloc > retain_size_) {
+      delete b;
+      return;
+    }
+    buffer_ = b;
+  }
+
+  size_t retainSize() const { return retain_size_; }
+  void setRetainSize(size_t size) { retain_size_ = size; }
+
+  /**
+   * @brief Scoped holder of an acquired buffer.
+   */
+  class Lease {
+  private:
+    Lease(const Lease&);
+    Lease& operator =(const Lease&);
+
+  public:
+    explicit Lease(BufferPool& pool) : pool_(pool), buffer_(pool.acquire()) {}
+    ~Lease() { pool_.release(buffer_); }
+
+    msgpack::sbuffer& operator *() { return *buffer_; }
+    msgpack::sbuffer* operator ->() { return buffer_; }
+
+  private:
+    BufferPool& pool_;
+    msgpack::sbuffer* buffer_;
+  };
+
+private:
+  msgpack::sbuffer* buffer_;
+  size_t retain_size_;
+};
+
 class PackerImpl {
 public:
+  PackerImpl()
+    : max_depth_(static_cast<size_t>(-1)), dedup_(false), dictionary_(NULL),
+      dictionary_ref_(LUA_NOREF) {}
   virtual ~PackerImpl() {}
 
+  /**
+   * @brief Sets the maximum depth of nested tables to be packed.
+   */
+  void setMaxDepth(size_t depth) { max_depth_ = depth; }
+
+  /**
+   * @brief Enables packing shared tables and repeated strings as
+   * references.
+   */
+  void setDedup(bool dedup) { dedup_ = dedup; }
+
+  /**
+   * @brief Sets the Dictionary at the given index to be used for map keys.
+   *
+   * The Dictionary is referred from the registry until releaseDictionary
+   * is called.
+   */
+  void setDictionary(lua_State* L, int index);
+  void releaseDictionary(lua_State* L);
+
   /**
    * @brief Serializes given data
    *
    * @return The number of return values.
    */
-  virtual int pack(lua_State* L, int arg_base) = 0;
+  int pack(lua_State* L, int arg_base);
 
   /**
    * @brief Serializes data as a table
    *
    * @return The number of return values.
    */
-  virtual int packTable(lua_State* L, int arg_base) = 0;
+  int packTable(lua_State* L, int arg_base);
 
   /**
    * @brief Serializes data as an array
    *
    * @return The number of return values.
    */
-  virtual int packArray(lua_State* L, int arg_base) = 0;
+  int packArray(lua_State* L, int arg_base);
+
+  /**
+   * @brief Serializes each element of the array at arg_base as an object
+   *
+   * The options are given at arg_base + 1. See parseManyOptions.
+   *
+   * @return The number of return values.
+   */
+  int packMany(lua_State* L, int arg_base);
 
   /**
    * @brief This function flushes serialized data
    * @return The number of return values.
    */
   virtual int flush(lua_State* L) = 0;
+
+  /**
+   * @brief Flushes serialized data and releases the output.
+   * @return The number of return values.
+   */
+  virtual int close(lua_State* L) { return flush(L); }
+
+  /**
+   * @brief Releases Lua values referred by this object.
+   *
+   * This function is called before the Packer userdata is collected.
+   */
+  virtual void finalize(lua_State* L) {}
+
+protected:
+  /**
+   * @brief Returns the buffer which the data of a pack call is appended
+   * to.
+   *
+   * @param offset Receives the size of the data to be kept in the buffer.
+   */
+  virtual msgpack::sbuffer* beginPack(lua_State* L, size_t* offset) = 0;
+
+  /**
+   * @brief Accepts the data appended to the buffer by a pack call.
+   *
+   * @param count The number of serialized objects.
+   * @return The number of return values.
+   */
+  virtual int endPack(lua_State* L, msgpack::sbuffer* buffer,
+                      int count) = 0;
+
+  /**
+   * @brief Discards the data appended to the buffer by a failed pack call.
+   */
+  virtual void abortPack(msgpack::sbuffer* buffer) {}
+
+  /**
+   * @brief Returns true if packMany can return the end offsets of objects.
+   */
+  virtual bool supportsOffsets() const { return false; }
+
+  /**
+   * @brief Applies the options of this object to the LuaObjects.
+   */
+  void configure(LuaObjects& obj) const;
+
+  /**
+   * @brief Checks the array and reads the options of packMany.
+   *
+   * The options are a table or a Dictionary, which is used for map keys.
+   *
+   * options:
+   *   length_prefix: precedes each object with its size in 4 bytes in big
+   *   endian
+   *   offsets: returns the end offsets of objects as well, which is
+   *   supported only by DirectPackerImpl
+   *   dictionary: the Dictionary used for map keys
+   */
+  static void parseManyOptions(lua_State* L, int arg_base,
+                               bool* length_prefix, bool* offsets,
+                               const Dictionary** dictionary);
+
+  size_t max_depth_;
+  bool dedup_;
+  const Dictionary* dictionary_;
+  int dictionary_ref_;
+
+private:
+  /**
+   * @brief Serializes the arguments from arg_base by the operation
+   * between beginPack and endPack.
+   *
+   * The operation is called as op(L, arg_base, obj, pk) and returns the
+   * number of serialized objects. A PackError thrown by it is raised as a
+   * Lua error after abortPack.
+   */
+  template<typename Operation>
+  int packWith(lua_State* L, int arg_base, const Operation& op);
 };
 
 class DirectPackerImpl : public PackerImpl {
 public:
-  DirectPackerImpl() {}
+  /**
+   * @param retain_size The maximum capacity of the output buffer kept
+   * between calls.
+   */
+  explicit DirectPackerImpl(size_t retain_size = BufferPool::DefaultRetainSize)
+    : pool_(retain_size) {}
   virtual ~DirectPackerImpl() {}
 
   /**
-   * @return Always returns 1, serialized data.
+   * @return Always returns 0, because this function flushes serialized
+   * data for each call of pack function.
    */
-  virtual int pack(lua_State* L, int arg_base);
+  virtual int flush(lua_State* L) { return 0; }
+
+protected:
+  virtual msgpack::sbuffer* beginPack(lua_State* L, size_t* offset);
 
   /**
-   * @return Always returns 1, serialized data.
+   * @return Always returns 1, serialized data. packMany returns the table
+   * of end offsets of objects as well if the option offsets is true.
    */
-  virtual int packTable(lua_State* L, int arg_base);
+  virtual int endPack(lua_State* L, msgpack::sbuffer* buffer, int count);
+
+  virtual void abortPack(msgpack::sbuffer* buffer);
+
+  virtual bool supportsOffsets() const { return true; }
+
+private:
+  BufferPool pool_;
+};
+
+/**
+ * @brief PackerImpl passing serialized data to a Lua function.
+ *
+ * Serialized data is accumulated in the buffer and is passed to the
+ * callback function when the size of the buffer reaches flush_size or
+ * flush is called. Data remaining in the buffer is discarded when the
+ * Packer is collected.
+ */
+class StreamPackerImpl : public PackerImpl {
+private:
+  StreamPackerImpl(const StreamPackerImpl&);
+  StreamPackerImpl& operator =(const StreamPackerImpl&);
+
+public:
+  static const size_t DefaultFlushSize = 64 * 1024;
 
   /**
-   * @return Always returns 1, serialized data.
+   * @param callback The reference to the callback function in the registry.
+   * @param flush_size The size of serialized data to call the callback.
+   * @param retain_size The maximum capacity of the buffer kept after
+   * flushing.
    */
-  virtual int packArray(lua_State* L, int arg_base);
+  StreamPackerImpl(int callback, size_t flush_size,
+                   size_t retain_size = BufferPool::DefaultRetainSize);
+  virtual ~StreamPackerImpl();
 
   /**
-   * @return Always returns 0, because this function flushes serialized
-   * data for each call of pack function.
+   * @brief Passes buffered data to the callback function.
+   * @return Always returns 0.
    */
-  virtual int flush(lua_State* L) { return 0; }
+  virtual int flush(lua_State* L);
+
+  virtual void finalize(lua_State* L);
+
+protected:
+  virtual msgpack::sbuffer* beginPack(lua_State* L, size_t* offset);
+
+  /**
+   * @brief Accepts data packed by the last call and flushes the buffer
+   * if it has enough data.
+   * @return Always returns 0.
+   */
+  virtual int endPack(lua_State* L, msgpack::sbuffer* buffer, int count);
+
+private:
+  int callback_;
+  size_t flush_size_;
+  BufferPool pool_;
+  msgpack::sbuffer* buffer_;
+
+  // The size of the data packed successfully. Data after this is left by
+  // a failed call and is discarded by the next call.
+  size_t committed_;
+};
+
+/**
+ * @brief PackerImpl writing serialized data to a file descriptor.
+ *
+ * Serialized data is accumulated in the buffer and is written when the
+ * size of the buffer reaches flush_size, the number of objects in the
+ * buffer reaches flush_count, or flush or close is called. Data remaining
+ * in the buffer is written when the Packer is collected.
+ */
+class FilePackerImpl : public PackerImpl {
+private:
+  FilePackerImpl(const FilePackerImpl&);
+  FilePackerImpl& operator =(const FilePackerImpl&);
+
+public:
+  /**
+   * @param fd The file descriptor to be written.
+   * @param owns_fd true if fd is closed by close.
+   * @param flush_size The size of serialized data to be written at once.
+   * @param flush_count The number of objects to be written at once, or 0
+   * for no limit.
+   * @param retain_size The maximum capacity of the buffer kept after
+   * flushing.
+   */
+  FilePackerImpl(int fd, bool owns_fd, size_t flush_size, size_t flush_count,
+                 size_t retain_size = BufferPool::DefaultRetainSize);
+  virtual ~FilePackerImpl();
+
+  /**
+   * @brief Writes buffered data to the file.
+   * @return Always returns 0.
+   */
+  virtual int flush(lua_State* L);
+
+  /**
+   * @brief Writes buffered data and closes the file if it is owned.
+   * @return Always returns 0.
+   */
+  virtual int close(lua_State* L);
+
+  virtual void finalize(lua_State* L);
+
+protected:
+  virtual msgpack::sbuffer* beginPack(lua_State* L, size_t* offset);
+
+  /**
+   * @brief Accepts data packed by the last call and writes the buffer
+   * if it has enough data. Each element of packMany is counted as an
+   * object.
+   * @return Always returns 0.
+   */
+  virtual int endPack(lua_State* L, msgpack::sbuffer* buffer, int count);
+
+private:
+  void checkOpen(lua_State* L) const;
+
+  /**
+   * @brief Writes all committed data.
+   *
+   * @return 0, or errno when writing failed.
+   */
+  int writeBuffer();
+
+private:
+  int fd_; // -1 after closed
+  bool owns_fd_;
+  size_t flush_size_;
+  size_t flush_count_;
+  BufferPool pool_;
+  msgpack::sbuffer* buffer_;
+
+  // The size of the data packed successfully. Data after this is left by
+  // a failed call and is discarded by the next call.
+  size_t committed_;
+
+  // The number of objects in the committed data.
+  size_t count_;
 };
 
 } // namespace lua
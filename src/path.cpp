@@ -0,0 +1,243 @@
+/*
+ * MessagePack for Lua
+ *
+ * Copyright (C) 2010 Nobuyuki Kubota
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "path.hpp"
+
+#include <cstring>
+#include "decoder.hpp"
+#include "format.hpp"
+#include "shared_references.hpp"
+
+namespace msgpack {
+namespace lua {
+namespace {
+/**
+ * @brief skipObject which throws an exception instead of returning NULL.
+ */
+const char* skipElement(const char* p, const char* end) {
+  Header h;
+  h.type = Header::NIL;
+  const char* next = skipObject(p, end, &h);
+  if (next == NULL) {
+    if (h.type == Header::INVALID) {
+      throw msgpack::unpack_error("invalid type");
+    }
+    throw msgpack::unpack_error("incomplete data");
+  }
+  return next;
+}
+
+/**
+ * @brief Converts a numeric header to the number pushed by Decoder.
+ *
+ * @return false if the header is not numeric.
+ */
+bool toNumber(const Header& h, lua_Number* n) {
+  if (h.type == Header::UNSIGNED_INTEGER) {
+    *n = static_cast<lua_Number>(h.value);
+  } else if (h.type == Header::SIGNED_INTEGER) {
+    *n = static_cast<lua_Number>(static_cast<int64_t>(h.value));
+  } else if (h.type == Header::FLOAT) {
+    uint32_t bits = static_cast<uint32_t>(h.value);
+    float f;
+    memcpy(&f, &bits, sizeof(f));
+    *n = f;
+  } else if (h.type == Header::DOUBLE) {
+    double d;
+    memcpy(&d, &h.value, sizeof(d));
+    *n = d;
+  } else {
+    return false;
+  }
+  return true;
+}
+
+/**
+ * @brief Returns true if the serialized key at p equals the Lua value at
+ * the given index after deserialization.
+ *
+ * The key must have been checked to be complete.
+ */
+bool matchKey(lua_State* L, int index, const char* p, const char* end) {
+  Header h;
+  if (!readHeader(p, end - p, &h)) {
+    throw msgpack::unpack_error("incomplete data");
+  }
+
+  switch (lua_type(L, index)) {
+  case LUA_TSTRING: {
+    if (h.type != Header::RAW) return false;
+    size_t len;
+    const char* s = lua_tolstring(L, index, &len);
+    return h.value == len && memcmp(p + h.size, s, len) == 0;
+  }
+
+  case LUA_TNUMBER: {
+    lua_Number n;
+    return toNumber(h, &n) && n == lua_tonumber(L, index);
+  }
+
+  case LUA_TBOOLEAN:
+    return h.type == Header::BOOLEAN &&
+      (h.value != 0) == (lua_toboolean(L, index) != 0);
+
+  default:
+    // Keys deserialized as tables never equal other values.
+    return false;
+  }
+}
+
+/**
+ * @brief Pushes the key at the beginning of the path onto the stack.
+ *
+ * @return The rest of the path.
+ */
+const char* parseKey(lua_State* L, const char* path, const char* all) {
+  if (*path == '[') {
+    // An index is a run of ASCII digits without a sign or spaces, and
+    // cannot exceed the size of a MessagePack array.
+    const char* end = path + 1;
+    uint64_t i = 0;
+    for (; *end >= '0' && *end <= '9'; end++) {
+      i = i * 10 + (*end - '0');
+      if (i > 0xffffffffU) luaL_error(L, "invalid path: %s", all);
+    }
+    if (end == path + 1 || *end != ']') {
+      luaL_error(L, "invalid path: %s", all);
+    }
+    lua_pushnumber(L, static_cast<lua_Number>(i));
+    return end + 1;
+  }
+
+  size_t len = strcspn(path, ".[");
+  if (len == 0) luaL_error(L, "invalid path: %s", all);
+  lua_pushlstring(L, path, len);
+  return path + len;
+}
+} // namespace
+
+const char* findElement(lua_State* L, int key, const char* p,
+                        const char* end) {
+  Header h;
+  if (!readHeader(p, end - p, &h)) {
+    throw msgpack::unpack_error("incomplete data");
+  }
+  p += h.size;
+
+  // Elements of a shared object cannot be read separately, since
+  // references in them refer to values before them.
+  if (h.type == Header::EXT &&
+      h.ext_type == SharedReferences::EnvelopeExtType) {
+    throw msgpack::unpack_error("keys cannot be looked up in a shared object");
+  }
+
+  if (h.type == Header::ARRAY) {
+    if (lua_type(L, key) != LUA_TNUMBER) return NULL;
+    lua_Number k = lua_tonumber(L, key);
+    if (k < 1 || k > static_cast<lua_Number>(h.value)) return NULL;
+    uint64_t i = static_cast<uint64_t>(k);
+    if (static_cast<lua_Number>(i) != k) return NULL;
+    for (; i > 1; i--) p = skipElement(p, end);
+    return p;
+  }
+
+  if (h.type == Header::MAP) {
+    for (uint64_t i = 0; i < h.value; i++) {
+      const char* value = skipElement(p, end);
+      if (matchKey(L, key, p, end)) return value;
+      p = skipElement(value, end);
+    }
+  }
+  return NULL;
+}
+
+int Path::get(lua_State* L) {
+  luaL_checklstring(L, 1, NULL);
+  return lookup(L, 1);
+}
+
+int Path::compile(lua_State* L) {
+  const char* all = luaL_checkstring(L, 1);
+  lua_settop(L, 1);
+
+  // upvalues: the number of keys, keys...
+  lua_pushnil(L);
+  int n = 0;
+  const char* path = all;
+  while (*path != '\0') {
+    // A key other than the first follows '.' if it is a name, or is an
+    // index in brackets. A name cannot be empty, even at the end.
+    if (n > 0) {
+      if (*path == '.') {
+        path++;
+        if (*path == '\0' || *path == '.' || *path == '[') {
+          luaL_error(L, "invalid path: %s", all);
+        }
+      } else if (*path != '[') {
+        luaL_error(L, "invalid path: %s", all);
+      }
+    }
+    luaL_checkstack(L, 2, "too many keys");
+    path = parseKey(L, path, all);
+    n++;
+  }
+  if (n == 0 || n > 254) luaL_error(L, "invalid path: %s", all);
+
+  lua_pushnumber(L, n);
+  lua_replace(L, 2);
+  lua_pushcclosure(L, &Path::call, n + 1);
+  return 1;
+}
+
+int Path::call(lua_State* L) {
+  luaL_checklstring(L, 1, NULL);
+  lua_settop(L, 1);
+
+  int n = static_cast<int>(lua_tonumber(L, lua_upvalueindex(1)));
+  luaL_checkstack(L, n, "too many keys");
+  for (int i = 1; i <= n; i++) {
+    lua_pushvalue(L, lua_upvalueindex(i + 1));
+  }
+  return lookup(L, 1);
+}
+
+int Path::lookup(lua_State* L, int data) {
+  size_t size;
+  const char* p = lua_tolstring(L, data, &size);
+  const char* end = p + size;
+  int n = lua_gettop(L);
+
+  bool failed = false;
+  try {
+    for (int key = data + 1; key <= n; key++) {
+      p = findElement(L, key, p, end);
+      if (p == NULL) return 0;
+    }
+    if (Decoder(L).decode(p, end - p) == 0) {
+      throw msgpack::unpack_error("incomplete data");
+    }
+  } catch (const msgpack::unpack_error& e) {
+    lua_pushfstring(L, "deserialization failed: %s", e.what());
+    failed = true;
+  }
+  if (failed) return lua_error(L);
+  return 1;
+}
+
+} // namespace lua
+} // namespace msgpack
@@ -0,0 +1,84 @@
+/*
+ * MessagePack for Lua
+ *
+ * Copyright (C) 2010 Nobuyuki Kubota
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef MSGPACK_LUA_PATH_HPP_
+#define MSGPACK_LUA_PATH_HPP_
+
+#include <lua.hpp>
+#include <msgpack.hpp>
+
+namespace msgpack {
+namespace lua {
+
+/**
+ * @brief Finds the element for the key at the given index in the
+ * serialized array or map at p.
+ *
+ * Elements of an array are indexed by 1, 2, .... A key of a map matches
+ * the Lua value when it equals the value after deserialization. Elements
+ * other than the found one are skipped by reading their headers.
+ *
+ * @return The beginning of the found element, or NULL when the key does
+ * not exist or the object at p is neither an array nor a map.
+ *
+ * @throw msgpack::unpack_error when data is malformed or incomplete, or
+ * the object at p is a shared object of SharedReferences.
+ */
+const char* findElement(lua_State* L, int key, const char* p, const char* end);
+
+/**
+ * @brief Extraction of a value in serialized data without deserializing
+ * the others.
+ *
+ * Usage:
+ * v = msgpack.get(data, "user", "items", 3, "price")
+ * p = msgpack.path("user.items[3].price")
+ * v = p(data)
+ */
+class Path {
+public:
+  /**
+   * @brief Returns the value addressed by the keys following serialized
+   * data, or nil when it does not exist.
+   */
+  static int get(lua_State* L);
+
+  /**
+   * @brief Parses a path and returns a function equivalent to get with
+   * its keys.
+   *
+   * A path consists of names separated by '.' and indices like [3]
+   * following a key directly. An empty name is an error, as is an index
+   * which is not a run of decimal digits or exceeds 2^32 - 1.
+   */
+  static int compile(lua_State* L);
+
+private:
+  static int call(lua_State* L);
+
+  /**
+   * @brief Pushes the value in the string at data addressed by the keys
+   * at data + 1, data + 2, ..., the top of the stack.
+   */
+  static int lookup(lua_State* L, int data);
+};
+
+} // namespace lua
+} // namespace msgpack
+
+#endif
@@ -0,0 +1,106 @@
+/*
+ * MessagePack for Lua
+ *
+ * Copyright (C) 2010 Nobuyuki Kubota
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "projection.hpp"
+
+#include <cstring>
+
+namespace msgpack {
+namespace lua {
+
+Projection::Projection() : given_(false) {
+}
+
+Projection::~Projection() {
+  clear();
+}
+
+bool Projection::parseOptions(lua_State* L, int options) {
+  lua_getfield(L, options, "fields");
+  if (lua_isnil(L, -1)) {
+    lua_pop(L, 1);
+    return false;
+  }
+
+  clear();
+  if (!lua_istable(L, -1) || !parse(L, lua_gettop(L))) {
+    clear();
+    luaL_error(L, "option 'fields' must be a table of names");
+  }
+  lua_pop(L, 1);
+  given_ = true;
+  return true;
+}
+
+bool Projection::parse(lua_State* L, int index) {
+  if (!lua_checkstack(L, 2)) return false;
+
+  lua_pushnil(L);
+  while (lua_next(L, index) != 0) {
+    Field f;
+    f.nested = NULL;
+    if (lua_type(L, -2) == LUA_TNUMBER && lua_type(L, -1) == LUA_TSTRING) {
+      size_t len;
+      const char* name = lua_tolstring(L, -1, &len);
+      f.name.assign(name, len);
+      fields_.push_back(f);
+
+    } else if (lua_type(L, -2) == LUA_TSTRING && lua_istable(L, -1)) {
+      size_t len;
+      const char* name = lua_tolstring(L, -2, &len);
+      f.name.assign(name, len);
+
+      // The nested projection is owned before being parsed so that it is
+      // released by clear when parsing fails.
+      f.nested = new Projection();
+      fields_.push_back(f);
+      if (!f.nested->parse(L, lua_gettop(L))) {
+        lua_pop(L, 2);
+        return false;
+      }
+
+    } else {
+      lua_pop(L, 2);
+      return false;
+    }
+    lua_pop(L, 1);
+  }
+  return true;
+}
+
+const Projection::Field* Projection::find(const char* key,
+                                          size_t size) const {
+  for (size_t i = 0; i < fields_.size(); i++) {
+    const Field& f = fields_[i];
+    if (f.name.size() == size && memcmp(f.name.data(), key, size) == 0) {
+      return &f;
+    }
+  }
+  return NULL;
+}
+
+void Projection::clear() {
+  for (size_t i = 0; i < fields_.size(); i++) {
+    delete fields_[i].nested;
+  }
+  fields_.clear();
+  given_ = false;
+}
+
+} // namespace lua
+} // namespace msgpack
@@ -0,0 +1,90 @@
+/*
+ * MessagePack for Lua
+ *
+ * Copyright (C) 2010 Nobuyuki Kubota
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef MSGPACK_LUA_PROJECTION_HPP_
+#define MSGPACK_LUA_PROJECTION_HPP_
+
+#include <string>
+#include <vector>
+#include <lua.hpp>
+
+namespace msgpack {
+namespace lua {
+
+/**
+ * @brief Set of map keys to be deserialized.
+ *
+ * A projection is given as a table like {"id", "ts", user = {"name"}}.
+ * Names in the array part select entries to be deserialized entirely, and
+ * a name in the hash part selects an entry whose value is deserialized
+ * with the nested projection. Entries having other keys are skipped
+ * without being deserialized, so an empty table selects no entry.
+ */
+class Projection {
+private:
+  Projection(const Projection&);
+  Projection& operator =(const Projection&);
+
+public:
+  struct Field {
+    std::string name;
+    Projection* nested; // NULL when the value is deserialized entirely
+  };
+
+  Projection();
+  ~Projection();
+
+  /**
+   * @brief Reads the fields option from the options table at the given
+   * index.
+   *
+   * @return false when the options do not have fields.
+   */
+  bool parseOptions(lua_State* L, int options);
+
+  /**
+   * @brief Returns the field whose name equals the given key, or NULL.
+   */
+  const Field* find(const char* key, size_t size) const;
+
+  size_t size() const { return fields_.size(); }
+
+  /**
+   * @brief Returns true when fields have been given, even as an empty
+   * table.
+   */
+  bool given() const { return given_; }
+
+  void clear();
+
+private:
+  /**
+   * @return false when the table at the given index is not a valid
+   * projection.
+   */
+  bool parse(lua_State* L, int index);
+
+private:
+  std::vector<Field> fields_;
+  bool given_;
+};
+
+} // namespace lua
+} // namespace msgpack
+
+#endif
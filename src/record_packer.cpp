@@ -0,0 +1,280 @@
+/*
+ * MessagePack for Lua
+ *
+ * Copyright (C) 2010 Nobuyuki Kubota
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "record_packer.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include "lua_objects.hpp"
+#include "pack_error.hpp"
+
+namespace msgpack {
+namespace lua {
+namespace {
+template<int (RecordPacker::*Memfun)(lua_State*)>
+int recordPackerProxy(lua_State* L) {
+  RecordPacker* p = *static_cast<RecordPacker**>(
+    luaL_checkudata(L, 1, RecordPacker::MetatableName));
+  return (p->*Memfun)(L);
+}
+} // namespace
+
+const char* const RecordPacker::MetatableName = "msgpack.RecordPacker";
+
+void RecordPacker::registerUserdata(lua_State* L) {
+  if (luaL_newmetatable(L, RecordPacker::MetatableName) == 0) {
+    lua_pop(L, 1);
+    return; // already created
+  }
+
+  // metatable.__index = metatable
+  lua_pushvalue(L, -1);
+  lua_setfield(L, -2, "__index");
+
+  // set __gc
+  lua_pushcfunction(L, &RecordPacker::finalizer);
+  lua_setfield(L, -2, "__gc");
+
+  // register methods
+  const struct luaL_Reg Methods[] = {
+    {"pack", &recordPackerProxy<&RecordPacker::pack>},
+    {NULL, NULL}
+  };
+  luaL_register(L, NULL, Methods);
+  lua_pop(L, 1);
+}
+
+int RecordPacker::create(lua_State* L) {
+  luaL_checktype(L, 1, LUA_TTABLE);
+  lua_settop(L, 1);
+
+  // The userdata is created first so that the RecordPacker is deleted by
+  // __gc even if the schema is invalid.
+  RecordPacker** p =
+    static_cast<RecordPacker**>(lua_newuserdata(L, sizeof(RecordPacker*)));
+  luaL_getmetatable(L, RecordPacker::MetatableName);
+  lua_setmetatable(L, -2);
+  *p = new RecordPacker();
+  RecordPacker* r = *p;
+  lua_newtable(L); // keys: 3
+
+  // fields in the array part
+  size_t n = lua_objlen(L, 1);
+  for (size_t i = 1; i <= n; i++) {
+    lua_rawgeti(L, 1, static_cast<int>(i));
+    if (lua_type(L, -1) != LUA_TSTRING) {
+      return luaL_error(L, "field names must be strings");
+    }
+    if (!r->addField(L, 3, ANY, NULL)) {
+      return lua_error(L);
+    }
+    lua_pop(L, 1);
+  }
+
+  // fields in the hash part, sorted by their names
+  // Errors are raised after the names are released.
+  bool ok = true;
+  {
+    std::vector<std::string> names;
+    lua_pushnil(L);
+    while (lua_next(L, 1) != 0) {
+      lua_pop(L, 1);
+      if (lua_type(L, -1) == LUA_TNUMBER) {
+        lua_Number k = lua_tonumber(L, -1);
+        if (k >= 1 && k <= n && k == static_cast<size_t>(k)) continue;
+      }
+      if (lua_type(L, -1) != LUA_TSTRING) {
+        lua_pushliteral(L, "field names must be strings");
+        ok = false;
+        break;
+      }
+      size_t len;
+      const char* name = lua_tolstring(L, -1, &len);
+      names.push_back(std::string(name, len));
+    }
+    std::sort(names.begin(), names.end());
+
+    for (size_t i = 0; ok && i < names.size(); i++) {
+      ok = r->addHashField(L, 3, names[i]);
+    }
+  }
+  if (!ok) {
+    return lua_error(L);
+  }
+
+  msgpack::sbuffer buffer;
+  BufferPacker pk(buffer);
+  pk.pack_map(static_cast<unsigned int>(r->fields_.size()));
+  r->header_.assign(buffer.data(), buffer.size());
+
+  r->keys_ = luaL_ref(L, LUA_REGISTRYINDEX);
+  return 1;
+}
+
+int RecordPacker::finalizer(lua_State* L) {
+  RecordPacker* p = *static_cast<RecordPacker**>(
+    luaL_checkudata(L, 1, RecordPacker::MetatableName));
+  luaL_unref(L, LUA_REGISTRYINDEX, p->keys_);
+  delete p;
+  return 0;
+}
+
+RecordPacker* RecordPacker::toRecordPacker(lua_State* L, int index) {
+  if (!lua_getmetatable(L, index)) return NULL;
+  luaL_getmetatable(L, RecordPacker::MetatableName);
+  bool is_record_packer = lua_rawequal(L, -1, -2) != 0;
+  lua_pop(L, 2);
+  if (!is_record_packer) return NULL;
+  return *static_cast<RecordPacker**>(lua_touserdata(L, index));
+}
+
+RecordPacker::RecordPacker() : keys_(LUA_NOREF) {
+}
+
+bool RecordPacker::addHashField(lua_State* L, int keys,
+                                const std::string& name) {
+  lua_pushlstring(L, name.data(), name.size());
+  lua_pushvalue(L, -1);
+  lua_rawget(L, 1);
+
+  Type type = ANY;
+  const RecordPacker* record = NULL;
+  if (lua_type(L, -1) != LUA_TSTRING) {
+    record = toRecordPacker(L, -1);
+    if (record == NULL) {
+      lua_pushfstring(L, "invalid way to pack field '%s'", name.c_str());
+      return false;
+    }
+    type = RECORD;
+    lua_pushboolean(L, 1);
+    lua_rawset(L, keys); // keys[record] = true
+  } else {
+    const char* way = lua_tostring(L, -1);
+    if (strcmp(way, "array") == 0) type = ARRAY;
+    else if (strcmp(way, "table") == 0) type = TABLE;
+    else if (strcmp(way, "any") != 0) {
+      lua_pushfstring(L, "invalid way to pack field '%s': %s",
+                      name.c_str(), way);
+      return false;
+    }
+    lua_pop(L, 1);
+  }
+  if (!addField(L, keys, type, record)) return false;
+  lua_pop(L, 1);
+  return true;
+}
+
+bool RecordPacker::addField(lua_State* L, int keys, Type type,
+                            const RecordPacker* record) {
+  size_t len;
+  const char* name = lua_tolstring(L, -1, &len);
+
+  // keys[name] marks names already added, which would be packed as
+  // duplicate keys of the map.
+  lua_pushvalue(L, -1);
+  lua_rawget(L, keys);
+  if (!lua_isnil(L, -1)) {
+    lua_pushfstring(L, "duplicate field '%s'", name);
+    return false;
+  }
+  lua_pop(L, 1);
+  lua_pushvalue(L, -1);
+  lua_pushboolean(L, 1);
+  lua_rawset(L, keys);
+
+  msgpack::sbuffer buffer;
+  BufferPacker pk(buffer);
+  pk.pack_raw(len);
+  pk.pack_raw_body(name, len);
+
+  Field f;
+  f.type = type;
+  f.key.assign(buffer.data(), buffer.size());
+  f.record = record;
+  fields_.push_back(f);
+
+  lua_pushvalue(L, -1);
+  lua_rawseti(L, keys, static_cast<int>(fields_.size()));
+  return true;
+}
+
+int RecordPacker::pack(lua_State* L) {
+  int n = lua_gettop(L);
+  {
+    BufferPool::Lease buffer(pool_);
+    try {
+      BufferPacker pk(*buffer);
+      for (int i = 2; i <= n; i++) {
+        packRecord(L, pk, i);
+      }
+      lua_pushlstring(L, buffer->data(), buffer->size());
+      return 1;
+    } catch (const PackError& e) {
+      lua_settop(L, n);
+      lua_pushstring(L, e.what());
+    }
+  }
+  // raised after the buffer is released
+  return lua_error(L);
+}
+
+void RecordPacker::packRecord(lua_State* L, BufferPacker& pk,
+                              int index) const {
+  if (lua_type(L, index) != LUA_TTABLE) {
+    throwPackError(L, "Arguments must be tables.");
+  }
+  if (!lua_checkstack(L, 3)) {
+    throwPackError(L, "too deeply nested");
+  }
+
+  msgpack::sbuffer& buffer = pk.buffer();
+  buffer.write(header_.data(), header_.size());
+
+  lua_rawgeti(L, LUA_REGISTRYINDEX, keys_);
+  int keys = lua_gettop(L);
+  int value = keys + 1;
+  for (size_t i = 0; i < fields_.size(); i++) {
+    const Field& f = fields_[i];
+    buffer.write(f.key.data(), f.key.size());
+
+    // The anchored name is used as the key without being interned again.
+    lua_rawgeti(L, keys, static_cast<int>(i + 1));
+    lua_rawget(L, index);
+    if (lua_isnil(L, value)) {
+      pk.pack_nil();
+    } else if (f.type == RECORD) {
+      f.record->packRecord(L, pk, value);
+    } else {
+      // The value is on the top, so a Dictionary value would be taken as
+      // the option of the arguments.
+      LuaObjects obj(L, value);
+      obj.setDictionaryArgument(false);
+      switch (f.type) {
+      case ANY: obj.msgpack_pack(pk); break;
+      case ARRAY: obj.packArray(pk); break;
+      case TABLE: obj.packTable(pk); break;
+      case RECORD: break;
+      }
+    }
+    lua_pop(L, 1);
+  }
+  lua_pop(L, 1);
+}
+
+} // namespace lua
+} // namespace msgpack
@@ -0,0 +1,138 @@
+/*
+ * MessagePack for Lua
+ *
+ * Copyright (C) 2010 Nobuyuki Kubota
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef MSGPACK_LUA_RECORD_PACKER_HPP_
+#define MSGPACK_LUA_RECORD_PACKER_HPP_
+
+#include <string>
+#include <vector>
+#include <lua.hpp>
+#include <msgpack.hpp>
+#include "buffer_packer.hpp"
+#include "packer_impl.hpp"
+
+namespace msgpack {
+namespace lua {
+
+/**
+ * @brief Packer of tables having a known set of fields.
+ *
+ * A schema lists field names in the array part, and names with the way
+ * to pack their values in the hash part:
+ *
+ * p = msgpack.compile{"id", "name", tags = "array", user = userPacker}
+ * data = p:pack(record [, ...])
+ *
+ * The way is one of "any" (the same as pack), "array" (packArray),
+ * "table" (packTable), or another compiled packer. A record is packed as
+ * a map having all the fields in the order of the schema; missing fields
+ * are packed as nil. Fields in the hash part follow those in the array
+ * part in the order of their names. A name given more than once is an
+ * error.
+ *
+ * The map header and the keys are serialized when the schema is compiled,
+ * so packing a record only looks up and packs the values.
+ */
+class RecordPacker {
+private:
+  RecordPacker(const RecordPacker&);
+  RecordPacker& operator =(const RecordPacker&);
+
+public:
+  static const char* const MetatableName;
+  static void registerUserdata(lua_State* L);
+
+  /**
+   * @brief Compiles the schema given as the 1st argument.
+   */
+  static int create(lua_State* L);
+
+private:
+  static int finalizer(lua_State* L);
+
+  /**
+   * @brief Returns the RecordPacker at the given index, or NULL if the
+   * value is not a RecordPacker.
+   */
+  static RecordPacker* toRecordPacker(lua_State* L, int index);
+
+public:
+  RecordPacker();
+
+  /**
+   * @brief Packs records.
+   *
+   * @return Always returns 1, serialized data.
+   */
+  int pack(lua_State* L);
+
+private:
+  enum Type {
+    ANY,
+    ARRAY,
+    TABLE,
+    RECORD
+  };
+
+  struct Field {
+    Type type;
+    std::string key; // serialized key
+    const RecordPacker* record; // used when type is RECORD
+  };
+
+  /**
+   * @brief Adds a field whose name is on the top of the stack.
+   *
+   * @param keys The index of the table keeping names.
+   * @return false with an error message pushed when the name has already
+   * been added.
+   */
+  bool addField(lua_State* L, int keys, Type type,
+                const RecordPacker* record);
+
+  /**
+   * @brief Adds a field given in the hash part of the schema at index 1.
+   *
+   * @return false with an error message pushed when the field is invalid.
+   */
+  bool addHashField(lua_State* L, int keys, const std::string& name);
+
+  /**
+   * @brief Packs the record at the given index.
+   *
+   * @throw PackError when the record cannot be packed.
+   */
+  void packRecord(lua_State* L, BufferPacker& pk, int index) const;
+
+private:
+  std::vector<Field> fields_;
+
+  // The serialized map header.
+  std::string header_;
+
+  // The reference to the table having field names at 1, 2, ..., and
+  // field names and nested RecordPackers as keys to keep them alive.
+  int keys_;
+
+  BufferPool pool_;
+};
+
+} // namespace lua
+} // namespace msgpack
+
+#endif
@@ -0,0 +1,79 @@
+/*
+ * MessagePack for Lua
+ *
+ * Copyright (C) 2010 Nobuyuki Kubota
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "scanner.hpp"
+
+#include "format.hpp"
+#include "limits.hpp"
+
+namespace msgpack {
+namespace lua {
+
+Scanner::Scanner()
+  : offset_(0), checked_(false), limits_(NULL), objects_(0) {
+}
+
+size_t Scanner::scan(const char* data, size_t size) {
+  while (offset_ < size) {
+    Header h;
+    if (!readHeader(data + offset_, size - offset_, &h)) return 0;
+    if (h.type == Header::INVALID) {
+      throw msgpack::unpack_error("invalid type");
+    }
+    // A header is checked before its payload is complete, but only once
+    // so that the object is not counted again when scanning is resumed.
+    if (limits_ != NULL && !checked_) {
+      limits_->check(h, remaining_.size(), &objects_);
+      checked_ = true;
+    }
+
+    uint64_t payload_size = h.payloadSize();
+    if (size - offset_ - h.size < payload_size) return 0;
+    offset_ += h.size + static_cast<size_t>(payload_size);
+    checked_ = false;
+
+    uint64_t n = h.elementCount();
+    if (n > 0) {
+      remaining_.push_back(n);
+      continue;
+    }
+
+    // An object has been completed. It also completes containers which
+    // have it as the last element.
+    for (;;) {
+      if (remaining_.empty()) {
+        size_t res = offset_;
+        reset();
+        return res;
+      }
+      if (--remaining_.back() > 0) break;
+      remaining_.pop_back();
+    }
+  }
+  return 0;
+}
+
+void Scanner::reset() {
+  offset_ = 0;
+  checked_ = false;
+  remaining_.clear();
+  objects_ = 0;
+}
+
+} // namespace lua
+} // namespace msgpack
@@ -0,0 +1,85 @@
+/*
+ * MessagePack for Lua
+ *
+ * Copyright (C) 2010 Nobuyuki Kubota
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef MSGPACK_LUA_SCANNER_HPP_
+#define MSGPACK_LUA_SCANNER_HPP_
+
+#include <vector>
+#include <msgpack.hpp>
+
+namespace msgpack {
+namespace lua {
+
+class Limits;
+
+/**
+ * @brief Finds the end of a serialized object without deserializing it.
+ *
+ * Scanning can be resumed when more data becomes available, so that each
+ * byte of a large object arriving in small chunks is scanned only once.
+ */
+class Scanner {
+public:
+  Scanner();
+
+  /**
+   * @brief Scans an object at the beginning of data.
+   *
+   * data has to begin with the same object as the previous call until this
+   * function returns non-zero value. Scanning continues from the position
+   * where the previous call stopped.
+   *
+   * @return The size of the object if data has the complete object.
+   * Otherwise, returns 0.
+   *
+   * @throw msgpack::unpack_error when data is malformed or exceeds the
+   * limits. Scanning has to be reset before scanning other data.
+   */
+  size_t scan(const char* data, size_t size);
+
+  /**
+   * @brief Discards the state of scanning.
+   */
+  void reset();
+
+  /**
+   * @brief Sets limits checked for each scanned header, or NULL.
+   */
+  void setLimits(const Limits* limits) { limits_ = limits; }
+
+private:
+  // The number of bytes scanned.
+  size_t offset_;
+
+  // true when the header at offset_ has been checked against limits while
+  // its payload is incomplete.
+  bool checked_;
+
+  // The number of remaining elements in each container being scanned.
+  std::vector<uint64_t> remaining_;
+
+  const Limits* limits_;
+
+  // The number of objects scanned in the top-level object.
+  size_t objects_;
+};
+
+} // namespace lua
+} // namespace msgpack
+
+#endif
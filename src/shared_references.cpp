@@ -0,0 +1,57 @@
+/*
+ * MessagePack for Lua
+ *
+ * Copyright (C) 2010 Nobuyuki Kubota
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "shared_references.hpp"
+
+#include "format.hpp"
+
+namespace msgpack {
+namespace lua {
+
+const int8_t SharedReferences::EnvelopeExtType;
+const int8_t SharedReferences::ReferenceExtType;
+const size_t SharedReferences::MinStringSize;
+
+void SharedReferences::pack(msgpack::sbuffer& buffer, uint32_t id) {
+  // fixext 1, 2 or 4
+  char data[6];
+  size_t width;
+  if (id < 0x100) {
+    data[0] = '\xd4';
+    width = 1;
+  } else if (id < 0x10000) {
+    data[0] = '\xd5';
+    width = 2;
+  } else {
+    data[0] = '\xd6';
+    width = 4;
+  }
+  data[1] = static_cast<char>(ReferenceExtType);
+  storeBigEndian(data + 2, id, width);
+  buffer.write(data, 2 + width);
+}
+
+uint32_t SharedReferences::read(const char* payload, size_t size) {
+  if (size != 1 && size != 2 && size != 4) {
+    throw msgpack::unpack_error("malformed reference");
+  }
+  return static_cast<uint32_t>(loadBigEndian(payload, size));
+}
+
+} // namespace lua
+} // namespace msgpack
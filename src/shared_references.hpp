@@ -0,0 +1,65 @@
+/*
+ * MessagePack for Lua
+ *
+ * Copyright (C) 2010 Nobuyuki Kubota
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef MSGPACK_LUA_SHARED_REFERENCES_HPP_
+#define MSGPACK_LUA_SHARED_REFERENCES_HPP_
+
+#include <msgpack.hpp>
+
+namespace msgpack {
+namespace lua {
+
+/**
+ * @brief Encoding of shared tables and repeated strings.
+ *
+ * An object packed in dedup mode is wrapped in an ext object of
+ * EnvelopeExtType. In it, tables packed as arrays or maps and strings of
+ * MinStringSize or more bytes are numbered from 0 in the order they first
+ * appear, and a value appearing again is packed as an ext object of
+ * ReferenceExtType whose payload is its number in big endian.
+ *
+ * Deserialization numbers values in the same order, so a reference is
+ * resolved to the same Lua value. This also allows a table containing
+ * itself to be packed. Numeric arrays are not numbered and are packed each
+ * time they appear.
+ */
+class SharedReferences {
+public:
+  static const int8_t EnvelopeExtType = 0x20;
+  static const int8_t ReferenceExtType = 0x21;
+
+  // Shorter strings are packed each time since a reference is not smaller.
+  static const size_t MinStringSize = 4;
+
+  /**
+   * @brief Appends a reference to the value of the given number.
+   */
+  static void pack(msgpack::sbuffer& buffer, uint32_t id);
+
+  /**
+   * @brief Reads the number from the payload of a reference.
+   *
+   * @throw msgpack::unpack_error when the payload is malformed.
+   */
+  static uint32_t read(const char* payload, size_t size);
+};
+
+} // namespace lua
+} // namespace msgpack
+
+#endif
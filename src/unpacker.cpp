@@ -18,8 +18,9 @@
 
 #include "unpacker.hpp"
 
-#include <memory>
-#include "lua_objects.hpp"
+#include "decoder.hpp"
+#include "options.hpp"
+#include "view.hpp"
 
 namespace msgpack {
 namespace lua {
@@ -32,6 +33,21 @@ int unpackerProxy(lua_State* L) {
 }
 } // namespace
 
+void Feeder::set(lua_State* L, int index) {
+  release(L);
+  lua_pushvalue(L, index);
+  ref_ = luaL_ref(L, LUA_REGISTRYINDEX);
+}
+
+void Feeder::release(lua_State* L) {
+  luaL_unref(L, LUA_REGISTRYINDEX, ref_);
+  ref_ = LUA_NOREF;
+}
+
+void Feeder::push(lua_State* L) const {
+  lua_rawgeti(L, LUA_REGISTRYINDEX, ref_);
+}
+
 const char* const Unpacker::MetatableName = "msgpack.Unpacker";
 
 void Unpacker::registerUserdata(lua_State* L) {
@@ -56,6 +72,8 @@ void Unpacker::registerUserdata(lua_State* L) {
   const struct luaL_Reg Methods[] = {
     {"next", &unpackerProxy<&Unpacker::next>},
     {"feed", &unpackerProxy<&Unpacker::feed>},
+    {"each", &unpackerProxy<&Unpacker::each>},
+    {"nextView", &unpackerProxy<&Unpacker::nextView>},
     {NULL, NULL}
   };
   luaL_register(L, NULL, Methods);
@@ -63,23 +81,57 @@ void Unpacker::registerUserdata(lua_State* L) {
 }
 
 int Unpacker::create(lua_State* L) {
-  // TODO: check the argument of constructor (feeding Lua function)
+  int feeder = 0;
+  int options = 1;
+  if (lua_isfunction(L, 1)) {
+    feeder = 1;
+    options = 2;
+  }
+  if (!lua_isnoneornil(L, options)) luaL_checktype(L, options, LUA_TTABLE);
+
+  // options:
+  //   retain_size: the maximum capacity of the buffer kept between calls
+  //   fields: the projection applied to deserialized objects
+  //   max_buffer_size, max_elements, max_depth, max_string_length,
+  //   max_objects: limits on deserialized objects (see Limits)
+  //   dictionary: the Dictionary used for map keys
+  size_t retain_size = FeedBuffer::DefaultRetainSize;
+  if (lua_istable(L, options)) {
+    retain_size = getSizeOption(L, options, "retain_size", retain_size);
+  }
 
   Unpacker** p = static_cast<Unpacker**>(lua_newuserdata(L, sizeof(Unpacker*)));
   luaL_getmetatable(L, Unpacker::MetatableName);
   lua_setmetatable(L, -2);
-  *p = new Unpacker();
+  *p = new Unpacker(retain_size);
+  if (feeder != 0) (*p)->feeder_.set(L, feeder);
+  if (lua_istable(L, options)) {
+    Unpacker* u = *p;
+    u->projection_.parseOptions(L, options);
+    u->limits_.parseOptions(L, options);
+    if (u->limits_.limitsObjects()) u->scanner_.setLimits(&u->limits_);
+    u->dictionary_ = Dictionary::getOption(L, options);
+    if (u->dictionary_ != NULL) {
+      lua_getfield(L, options, "dictionary");
+      u->dictionary_ref_ = luaL_ref(L, LUA_REGISTRYINDEX);
+    }
+  }
   return 1;
 }
 
 int Unpacker::finalizer(lua_State* L) {
   Unpacker* p =
     *static_cast<Unpacker**>(luaL_checkudata(L, 1, Unpacker::MetatableName));
+  p->feeder_.release(L);
+  luaL_unref(L, LUA_REGISTRYINDEX, p->dictionary_ref_);
+  p->buffer_.clear(L);
   delete p;
   return 0;
 }
 
-Unpacker::Unpacker() {
+Unpacker::Unpacker(size_t retain_size)
+  : buffer_(retain_size), dictionary_(NULL), dictionary_ref_(LUA_NOREF),
+    decoding_(false) {
 }
 
 Unpacker::~Unpacker() {
@@ -90,54 +142,215 @@ int Unpacker::feed(lua_State* L) {
 }
 
 int Unpacker::feed(lua_State* L, int arg_base) {
-  // TODO: check feeding function
-  
-  // check arguments first to avoid copying serialized data incompletely
+  checkNotDecoding(L);
+
+  // check arguments first to avoid feeding serialized data incompletely
   int n = lua_gettop(L);
-  std::vector<std::pair<const char*, size_t> > strs;
-  size_t total_size = 0;
+  size_t size = 0;
   for (int i = arg_base; i <= n; i++) {
     size_t len;
-    const char* v = luaL_checklstring(L, i, &len);
-    strs.push_back(std::make_pair(v, len));
-    total_size += len;
+    luaL_checklstring(L, i, &len);
+    size += len;
   }
+  checkBufferSize(L, size);
 
-  // copy strings to the buffer
-  unpacker_.reserve_buffer(total_size);
-  for (size_t i = 0, offs = 0; i < strs.size(); i++) {
-    memcpy(unpacker_.buffer() + offs, strs[i].first, strs[i].second);
-    offs += strs[i].second;
+  // strings are referred from the buffer instead of being copied
+  buffer_.shift(L);
+  for (int i = arg_base; i <= n; i++) {
+    buffer_.append(L, i);
   }
-  unpacker_.buffer_consumed(total_size);
   return 0;
 }
 
 int Unpacker::next(lua_State* L) {
-  // feed data until execute returns true
+  // for v in unpacker, feeder do ... end passes feeder as the 2nd argument
+  if (lua_isfunction(L, 2)) return next(L, 2);
+  if (feeder_.empty()) return next(L, 0);
+
+  feeder_.push(L);
+  return next(L, lua_gettop(L));
+}
+
+int Unpacker::next(lua_State* L, int feeder) {
+  checkNotDecoding(L);
+  bool unpacked = false;
+  bool failed = false;
   try {
-    msgpack::unpacked data;
-    while (!unpacker_.next(&data)) {
-      // TODO: check the argument for feeding function and call it
-      // TODO: call the feeding function passed to constructor
+    unpacked = unpackNext(L, feeder);
+  } catch (const msgpack::unpack_error& e) {
+    lua_pushfstring(L, "deserialization failed: %s", e.what());
+    failed = true;
+  }
 
-      // FIXME: currently, this function simply returns
-      return 0;
+  // The error is raised after the exception is destroyed, since lua_error
+  // does not unwind it.
+  if (failed) return lua_error(L);
+  return unpacked ? 1 : 0;
+}
+
+bool Unpacker::scanNext(lua_State* L, int feeder, size_t* size) {
+  buffer_.shift(L);
+
+  // feed data until the buffer has a complete object
+  for (;;) {
+    try {
+      *size = scanner_.scan(buffer_.data(), buffer_.size());
+    } catch (const msgpack::unpack_error&) {
+      // The end of a malformed object or one exceeding the limits is
+      // unknown, so the buffered data cannot be scanned any more.
+      scanner_.reset();
+      buffer_.clear(L);
+      throw;
     }
+    if (*size != 0) return true;
+    if (buffer_.extend(L)) continue;
+    if (feeder == 0 || !callFeeder(L, feeder)) return false;
+  }
+}
+
+bool Unpacker::unpackNext(lua_State* L, int feeder) {
+  size_t size;
+  if (!scanNext(L, feeder, &size)) return false;
 
-    msgpack::object msg = data.get();
-    LuaObjects res(L);
-    res.msgpack_unpack(msg);
-    return 1;
+  // The object is consumed before building Lua values so that an error
+  // raised while building them does not make the object stay in the buffer.
+  // The consumed data remains valid until the next call of shift.
+  const char* data = buffer_.data();
+  buffer_.consume(size);
+  // Objects are checked again by Decoder since Scanner does not look into
+  // objects having references. Ext decoders must not release the data by
+  // using this Unpacker meanwhile.
+  decoding_ = true;
+  try {
+    Decoder(L, projection_.given() ? &projection_ : NULL,
+            limits_.limitsObjects() ? &limits_ : NULL,
+            dictionary_).decode(data, size);
+  } catch (...) {
+    decoding_ = false;
+    throw;
+  }
+  decoding_ = false;
+  return true;
+}
+
+int Unpacker::nextView(lua_State* L) {
+  checkNotDecoding(L);
+  int feeder = 0;
+  if (lua_isfunction(L, 2)) {
+    feeder = 2;
+  } else if (!feeder_.empty()) {
+    feeder_.push(L);
+    feeder = lua_gettop(L);
+  }
 
+  size_t size = 0;
+  bool failed = false;
+  try {
+    if (!scanNext(L, feeder, &size)) return 0;
   } catch (const msgpack::unpack_error& e) {
-    return luaL_error(L, "deserialization failed: %s", e.what());
+    lua_pushfstring(L, "deserialization failed: %s", e.what());
+    failed = true;
+  }
+  if (failed) return lua_error(L);
+
+  // An object in the bridge is copied since the bridge is reused.
+  const char* data = buffer_.data();
+  if (!buffer_.pushSource(L)) {
+    lua_pushlstring(L, data, size);
+    data = lua_tostring(L, -1);
+  }
+  buffer_.consume(size);
+  View::push(L, lua_gettop(L), data, size);
+  return 1;
+}
+
+bool Unpacker::callFeeder(lua_State* L, int feeder) {
+  size_t size = buffer_.totalSize();
+  lua_pushvalue(L, feeder);
+  lua_pushvalue(L, 1); // Unpacker
+  lua_call(L, 1, 1);
+
+  // The feeding function may have fed data by calling feed.
+  if (!lua_isnil(L, -1)) {
+    if (lua_type(L, -1) != LUA_TSTRING) {
+      luaL_error(L, "feeding function must return a string or nil");
+    }
+    checkBufferSize(L, lua_objlen(L, -1));
+    buffer_.append(L, -1);
+  }
+  lua_pop(L, 1);
+  return buffer_.totalSize() != size;
+}
+
+void Unpacker::checkNotDecoding(lua_State* L) const {
+  if (decoding_) {
+    luaL_error(L, "cannot use an Unpacker while it is deserializing");
+  }
+}
+
+void Unpacker::checkBufferSize(lua_State* L, size_t size) const {
+  size_t total = buffer_.totalSize();
+  if (size > limits_.maxBufferSize() - total) {
+    luaL_error(L, "buffer size exceeds the limit");
   }
 }
 
 int Unpacker::each(lua_State* L) {
-  // TODO: implement
-  return 0;
+  checkNotDecoding(L);
+  luaL_checktype(L, 2, LUA_TFUNCTION);
+  lua_Integer batch_size = luaL_optinteger(L, 3, 0);
+  luaL_argcheck(L, batch_size >= 0, 3, "batch size must be non-negative");
+
+  int feeder = 0;
+  if (!feeder_.empty()) {
+    feeder_.push(L);
+    feeder = lua_gettop(L);
+  }
+
+  lua_Integer count = 0;
+  bool failed = false;
+  try {
+    if (batch_size == 0) {
+      lua_pushvalue(L, 2);
+      while (unpackNext(L, feeder)) {
+        lua_call(L, 1, 0);
+        count++;
+        lua_pushvalue(L, 2);
+      }
+      lua_pop(L, 1);
+
+    } else {
+      // Objects are passed as arrays having batch_size elements, except for
+      // the last one.
+      const int MaxPreallocSize = 1024;
+      int prealloc_size = batch_size < MaxPreallocSize ?
+        static_cast<int>(batch_size) : MaxPreallocSize;
+      int n = 0;
+      lua_pushvalue(L, 2);
+      lua_createtable(L, prealloc_size, 0);
+      while (unpackNext(L, feeder)) {
+        lua_rawseti(L, -2, ++n);
+        count++;
+        if (n == batch_size) {
+          lua_call(L, 1, 0);
+          n = 0;
+          lua_pushvalue(L, 2);
+          lua_createtable(L, prealloc_size, 0);
+        }
+      }
+
+      if (n > 0) lua_call(L, 1, 0);
+      else lua_pop(L, 2);
+    }
+
+  } catch (const msgpack::unpack_error& e) {
+    lua_pushfstring(L, "deserialization failed: %s", e.what());
+    failed = true;
+  }
+  if (failed) return lua_error(L);
+
+  lua_pushnumber(L, count);
+  return 1;
 }
 
 } // namespace lua
@@ -21,14 +21,50 @@
 
 #include <lua.hpp>
 #include <msgpack.hpp>
+#include "dictionary.hpp"
+#include "feed_buffer.hpp"
+#include "limits.hpp"
+#include "projection.hpp"
+#include "scanner.hpp"
 
 namespace msgpack {
 namespace lua {
 
 /**
- * @todo implement Feeder for Unpacker to use user defined feeding function.
+ * @brief User defined feeding function of Unpacker.
+ *
+ * A feeding function is called with the Unpacker when the Unpacker needs
+ * more data. It can feed data by calling unpacker:feed, by returning a
+ * string, or both. It returns nil when no more data exists.
  */
-class Feeder;
+class Feeder {
+private:
+  Feeder(const Feeder&);
+  Feeder& operator =(const Feeder&);
+
+public:
+  Feeder() : ref_(LUA_NOREF) {}
+
+  /**
+   * @brief Sets the function at the given index as the feeding function.
+   */
+  void set(lua_State* L, int index);
+
+  /**
+   * @brief Releases the feeding function.
+   */
+  void release(lua_State* L);
+
+  bool empty() const { return ref_ == LUA_NOREF; }
+
+  /**
+   * @brief Pushes the feeding function onto the stack.
+   */
+  void push(lua_State* L) const;
+
+private:
+  int ref_;
+};
 
 class Unpacker {
 private:
@@ -44,11 +80,17 @@ private:
   static int finalizer(lua_State* L);
 
 public:
-  Unpacker();
+  /**
+   * @param retain_size The maximum capacity of the internal buffer kept
+   * after the object in it is deserialized.
+   */
+  explicit Unpacker(size_t retain_size = FeedBuffer::DefaultRetainSize);
   ~Unpacker();
 
   /**
    * @brief feeding serialized data
+   *
+   * Fed strings are not copied but referred until they are deserialized.
    */
   int feed(lua_State* L);
 
@@ -66,9 +108,9 @@ public:
    * @note this function can be call in two ways:
    * unpacker.data() or unpacker().
    *
-   * memo:
-   * Currently, Unpacker only support manual feeding by calling feed function.
-   * Feeding from user defined function should also be supported. 
+   * When the buffer does not have a complete object, the feeding function
+   * is called until it feeds no more data. The feeding function given to
+   * this function takes priority over the one passed to the constructor.
    *
    * example code:
    * p = msgpack.Unpacker([feeder1])
@@ -78,30 +120,108 @@ public:
    *
    * There can be three type of feeding functions:
    *
-   * 1. funciton f (unpacker) unpacker.feed("data") end
+   * 1. funciton f (unpacker) unpacker:feed("data") end
    * 2. function f () return "data" end --> feed "data"
-   * 3. function f (unpacker) unpacker.feed("data1"); return "data2" end
-   *      --> feed "data2"
+   * 3. function f (unpacker) unpacker:feed("data1"); return "data2" end
+   *      --> feed "data1" and "data2"
    *
-   * 3 may be good. Every function returns nil when no more feed exists.
+   * Every function returns nil when no more feed exists. See Feeder.
    */
   int next(lua_State* L);
 
+  /**
+   * @brief next function with the index of the feeding function.
+   *
+   * @param feeder The index of the feeding function, or 0 when no
+   * feeding function is used.
+   */
+  int next(lua_State* L, int feeder);
+
   /**
    * @brief deserialize objects and pass them to the given function.
    *
+   * When batch_size is given, objects are passed as arrays having at most
+   * batch_size objects. The feeding function passed to the constructor is
+   * called when the buffer does not have a complete object.
+   *
+   * @return The number of deserialized objects.
+   *
    * @pre
    * Usage:
    * p = msgpack.Unpacker()
    * -- feed data
    * p:each(function (object)
    *   -- process deserialized object here
-   * end)
+   * end [, batch_size])
    */
   int each(lua_State* L);
 
+  /**
+   * @brief Get the next object as a View if exists.
+   *
+   * This works like next, but an array or a map is returned as a View
+   * which deserializes its elements only when they are accessed. The View
+   * refers to the fed string when the object is not lying across strings.
+   * The fields option is not applied to the View.
+   */
+  int nextView(lua_State* L);
+
+private:
+  /**
+   * @brief Finds the next complete object in the buffer, calling the
+   * feeding function at the given index if necessary.
+   *
+   * @return false when no more object is available. Otherwise, the object
+   * begins at buffer_.data() and its size is stored to size.
+   *
+   * @throw msgpack::unpack_error when the object is malformed or exceeds
+   * the limits, after the buffered data is discarded.
+   */
+  bool scanNext(lua_State* L, int feeder, size_t* size);
+
+  /**
+   * @brief Deserializes the next object and pushes it onto the stack,
+   * calling the feeding function at the given index if necessary.
+   *
+   * @return false when no more object is available.
+   */
+  bool unpackNext(lua_State* L, int feeder);
+
+  /**
+   * @brief Calls the feeding function at the given index.
+   *
+   * @return true if any data is fed.
+   */
+  bool callFeeder(lua_State* L, int feeder);
+
+  /**
+   * @brief Raises an error if an ext decoder called while deserializing
+   * uses this Unpacker, which would release the data being deserialized.
+   */
+  void checkNotDecoding(lua_State* L) const;
+
+  /**
+   * @brief Raises an error if the buffer cannot have more data of the
+   * given size.
+   */
+  void checkBufferSize(lua_State* L, size_t size) const;
+
 private:
-  msgpack::unpacker unpacker_;
+  // Serialized data is deserialized by Decoder after Scanner finds a
+  // complete object in the buffer.
+  FeedBuffer buffer_;
+  Scanner scanner_;
+  Feeder feeder_;
+  Projection projection_;
+  Limits limits_;
+
+  // The Dictionary used for map keys, which is referred from the registry
+  // by dictionary_ref_.
+  const Dictionary* dictionary_;
+  int dictionary_ref_;
+
+  // true while an object is deserialized. See checkNotDecoding.
+  bool decoding_;
 };
 
 } // namespace lua
@@ -0,0 +1,207 @@
+/*
+ * MessagePack for Lua
+ *
+ * Copyright (C) 2010 Nobuyuki Kubota
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "view.hpp"
+
+#include <new>
+#include "decoder.hpp"
+#include "format.hpp"
+#include "path.hpp"
+#include "shared_references.hpp"
+
+namespace msgpack {
+namespace lua {
+namespace {
+template<int (View::*Memfun)(lua_State*)>
+int viewProxy(lua_State* L) {
+  View* v = static_cast<View*>(luaL_checkudata(L, 1, View::MetatableName));
+  return (v->*Memfun)(L);
+}
+
+bool isContainer(const Header& h) {
+  return h.type == Header::ARRAY || h.type == Header::MAP;
+}
+
+void decode(lua_State* L, const char* data, size_t size) {
+  bool failed = false;
+  try {
+    Decoder(L).decode(data, size);
+  } catch (const msgpack::unpack_error& e) {
+    lua_pushfstring(L, "deserialization failed: %s", e.what());
+    failed = true;
+  }
+  if (failed) lua_error(L);
+}
+} // namespace
+
+const char* const View::MetatableName = "msgpack.View";
+
+void View::registerUserdata(lua_State* L) {
+  if (luaL_newmetatable(L, View::MetatableName) == 0) {
+    lua_pop(L, 1);
+    return; // already created
+  }
+
+  // Elements are looked up by __index, so View has no methods.
+  lua_pushcfunction(L, &viewProxy<&View::index>);
+  lua_setfield(L, -2, "__index");
+
+  lua_pushcfunction(L, &viewProxy<&View::length>);
+  lua_setfield(L, -2, "__len");
+
+  // used by pairs of Lua 5.2 or later
+  lua_pushcfunction(L, &View::pairs);
+  lua_setfield(L, -2, "__pairs");
+
+  // View has nothing to be released, so it has no __gc.
+  lua_pop(L, 1);
+}
+
+int View::create(lua_State* L) {
+  size_t size;
+  const char* data = luaL_checklstring(L, 1, &size);
+
+  // Checking the whole object here allows elements to be read without
+  // checking them again.
+  Header h;
+  h.type = Header::NIL;
+  const char* end = skipObject(data, data + size, &h);
+  if (end == NULL) {
+    if (h.type == Header::INVALID) {
+      return luaL_error(L, "deserialization failed: invalid type");
+    }
+    return luaL_error(L, "deserialization failed: incomplete data");
+  }
+
+  push(L, 1, data, end - data);
+  return 1;
+}
+
+void View::push(lua_State* L, int source, const char* data, size_t size) {
+  Header h;
+  readHeader(data, size, &h);
+  if (h.type == Header::EXT &&
+      h.ext_type == SharedReferences::EnvelopeExtType) {
+    luaL_error(L, "cannot view a shared object");
+    return;
+  }
+  if (!isContainer(h)) {
+    decode(L, data, size);
+    return;
+  }
+
+  // The environment table anchoring the string.
+  lua_createtable(L, 1, 0);
+  lua_pushvalue(L, source);
+  lua_rawseti(L, -2, 1);
+  pushView(L, lua_gettop(L), data, size);
+  lua_remove(L, -2);
+}
+
+void View::pushView(lua_State* L, int env, const char* data, size_t size) {
+  View* v = static_cast<View*>(lua_newuserdata(L, sizeof(View)));
+  new (v) View(data, size);
+  luaL_getmetatable(L, View::MetatableName);
+  lua_setmetatable(L, -2);
+  lua_pushvalue(L, env);
+  lua_setfenv(L, -2);
+}
+
+int View::pairs(lua_State* L) {
+  View* v = static_cast<View*>(luaL_checkudata(L, 1, View::MetatableName));
+  Header h;
+  readHeader(v->data_, v->size_, &h);
+
+  // upvalues: the View, the offset of the next element, the number of
+  // elements already iterated
+  lua_pushvalue(L, 1);
+  lua_pushnumber(L, h.size);
+  lua_pushnumber(L, 0);
+  lua_pushcclosure(L, &View::iterate, 3);
+  return 1;
+}
+
+int View::iterate(lua_State* L) {
+  View* v = static_cast<View*>(lua_touserdata(L, lua_upvalueindex(1)));
+  size_t offset = static_cast<size_t>(lua_tonumber(L, lua_upvalueindex(2)));
+  uint64_t i = static_cast<uint64_t>(lua_tonumber(L, lua_upvalueindex(3)));
+
+  Header h;
+  readHeader(v->data_, v->size_, &h);
+  if (i >= h.value) return 0;
+
+  const char* end = v->data_ + v->size_;
+  const char* p = v->data_ + offset;
+  bool is_array = h.type == Header::ARRAY;
+  if (is_array) {
+    lua_pushnumber(L, static_cast<lua_Number>(i + 1));
+  } else {
+    v->pushElement(L, lua_upvalueindex(1), p); // key
+    p = skipObject(p, end, &h);
+  }
+  v->pushElement(L, lua_upvalueindex(1), p);
+  p = skipObject(p, end, &h);
+
+  lua_pushnumber(L, p - v->data_);
+  lua_replace(L, lua_upvalueindex(2));
+  lua_pushnumber(L, static_cast<lua_Number>(i + 1));
+  lua_replace(L, lua_upvalueindex(3));
+  return 2;
+}
+
+int View::unpack(lua_State* L) {
+  View* v = static_cast<View*>(luaL_checkudata(L, 1, View::MetatableName));
+  decode(L, v->data_, v->size_);
+  return 1;
+}
+
+View::View(const char* data, size_t size) : data_(data), size_(size) {
+}
+
+int View::index(lua_State* L) {
+  // The object has been checked, so findElement never throws.
+  const char* p = findElement(L, 2, data_, data_ + size_);
+  if (p == NULL) return 0;
+  pushElement(L, 1, p);
+  return 1;
+}
+
+int View::length(lua_State* L) {
+  Header h;
+  if (!readHeader(data_, size_, &h)) return 0;
+  lua_pushnumber(L, static_cast<lua_Number>(h.value));
+  return 1;
+}
+
+void View::pushElement(lua_State* L, int self, const char* p) const {
+  Header h;
+  const char* end = skipObject(p, data_ + size_, &h);
+  readHeader(p, end - p, &h);
+  if (!isContainer(h)) {
+    decode(L, p, end - p);
+    return;
+  }
+
+  // The View of the element shares the environment.
+  lua_getfenv(L, self);
+  pushView(L, lua_gettop(L), p, end - p);
+  lua_remove(L, -2);
+}
+
+} // namespace lua
+} // namespace msgpack
@@ -0,0 +1,123 @@
+/*
+ * MessagePack for Lua
+ *
+ * Copyright (C) 2010 Nobuyuki Kubota
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef MSGPACK_LUA_VIEW_HPP_
+#define MSGPACK_LUA_VIEW_HPP_
+
+#include <lua.hpp>
+#include <msgpack.hpp>
+
+namespace msgpack {
+namespace lua {
+
+/**
+ * @brief Read-only view of a serialized array or map.
+ *
+ * A View refers to the serialized data in a Lua string and deserializes
+ * an element only when it is accessed. An element which is an array or
+ * a map is returned as another View referring to the same string.
+ *
+ * The View is stored in the userdata itself, and the string is anchored
+ * by the environment table of the userdata, which is shared by the Views
+ * of elements. So accessing an element allocates only the userdata.
+ *
+ * Usage:
+ * v = msgpack.view(data)
+ * v.key, v[1], #v
+ * for k, e in msgpack.pairs(v) do ... end
+ * t = msgpack.unpackView(v) -- deserializes the whole object
+ */
+class View {
+private:
+  View(const View&);
+  View& operator =(const View&);
+
+public:
+  static const char* const MetatableName;
+  static void registerUserdata(lua_State* L);
+
+  /**
+   * @brief Creates a View of the object at the beginning of the string
+   * given as the 1st argument.
+   */
+  static int create(lua_State* L);
+
+  /**
+   * @brief Pushes a View of the object at data.
+   *
+   * @param source The index of the string containing data. The data must
+   * be a complete object which has already been checked. A shared object
+   * of SharedReferences cannot be viewed, since references in elements
+   * refer to values before them.
+   */
+  static void push(lua_State* L, int source, const char* data, size_t size);
+
+  /**
+   * @brief Returns an iterator of elements of the View given as the 1st
+   * argument. Arrays are iterated with indices beginning with 1.
+   */
+  static int pairs(lua_State* L);
+
+  /**
+   * @brief Deserializes the whole object of the View given as the 1st
+   * argument.
+   */
+  static int unpack(lua_State* L);
+
+private:
+  static int iterate(lua_State* L);
+
+  /**
+   * @brief Pushes a View of the array or the map at data.
+   *
+   * @param env The index of the environment table anchoring the string.
+   */
+  static void pushView(lua_State* L, int env, const char* data, size_t size);
+
+public:
+  View(const char* data, size_t size);
+
+  /**
+   * @brief Returns the element for the key given as the 2nd argument, or
+   * nil when the key does not exist.
+   */
+  int index(lua_State* L);
+
+  /**
+   * @brief Returns the number of elements of an array, or the number of
+   * entries of a map.
+   */
+  int length(lua_State* L);
+
+private:
+  /**
+   * @brief Pushes the object at p, as a View if it is an array or a map.
+   *
+   * @param self The index of the userdata of this View.
+   */
+  void pushElement(lua_State* L, int self, const char* p) const;
+
+private:
+  const char* data_;
+  size_t size_;
+};
+
+} // namespace lua
+} // namespace msgpack
+
+#endif
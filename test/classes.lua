@@ -0,0 +1,41 @@
+-- Tables of classes registered by registerClass.
+require "msgpack"
+
+local Point = {}
+Point.__index = Point
+Point.label = "default"
+msgpack.registerClass("Point", Point, {"x", "y", "label"})
+
+local Line = {}
+msgpack.registerClass("Line", Line, {"from", "to"})
+
+-- Defaults given by __index are not packed, and are seen again through
+-- the metatable.
+do
+  local a = setmetatable({x = 1, y = 2}, Point)
+  local t = msgpack.unpack(msgpack.pack(a))
+  assert(getmetatable(t) == Point and rawget(t, "label") == nil)
+  assert(t.label == "default" and t.x == 1 and t.y == 2)
+end
+
+-- Classes are found by their names among several classes.
+do
+  local l = setmetatable({from = setmetatable({x = 0, y = 0}, Point),
+                          to = setmetatable({x = 3, y = 4}, Point)}, Line)
+  local t = msgpack.unpack(msgpack.pack(l))
+  assert(getmetatable(t) == Line and getmetatable(t.to) == Point)
+  assert(t.to.x == 3 and t.from.y == 0)
+end
+
+-- A class registered again by the same name replaces the old one.
+do
+  local Point2 = {}
+  msgpack.registerClass("Point", Point2, {"y", "x"})
+  local t = msgpack.unpack(msgpack.pack(setmetatable({x = 1, y = 2}, Point2)))
+  assert(getmetatable(t) == Point2 and t.x == 1 and t.y == 2)
+  local line = setmetatable({from = 1, to = 2}, Line)
+  assert(getmetatable(msgpack.unpack(msgpack.pack(line))) == Line)
+  -- Point is no longer registered, so its tables are packed as maps.
+  t = msgpack.unpack(msgpack.pack(setmetatable({x = 1}, Point)))
+  assert(getmetatable(t) == nil and t.x == 1)
+end
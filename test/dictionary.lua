@@ -0,0 +1,48 @@
+-- Map keys packed by their positions in a Dictionary.
+require "msgpack"
+
+local d = msgpack.Dictionary{"name", "id", "tags"}
+local p = msgpack.Packer{dictionary = d}
+
+-- Integral keys colliding with positions in the Dictionary, and those
+-- after them, are unpacked into the array part.
+do
+  local t = msgpack.unpack(p:pack({10, 20, 30, 40, 50, name = "x", id = 7}),
+                           {dictionary = d})
+  assert(#t == 5 and t[1] == 10 and t[3] == 30 and t[5] == 50)
+  assert(t.name == "x" and t.id == 7)
+
+  t = msgpack.unpack(p:pack({[2] = "b", [4] = "d", tags = {1}}),
+                     {dictionary = d})
+  assert(t[2] == "b" and t[4] == "d" and t[1] == nil and t.tags[1] == 1)
+end
+
+-- Positions are not confused with integral keys.
+do
+  local t = msgpack.unpack(p:pack({name = "n", id = 1, tags = "t"}),
+                           {dictionary = d})
+  assert(t.name == "n" and t.id == 1 and t.tags == "t" and t[1] == nil)
+end
+
+-- packMany takes a Dictionary as its options or in the field dictionary.
+do
+  local records = {{name = "a", id = 1}, {name = "b", tags = {2}}}
+  local expected = p:packMany(records)
+  assert(msgpack.packMany(records, d) == expected)
+  local data, ends = msgpack.packMany(records, {offsets = true,
+                                                dictionary = d})
+  assert(data == expected and #ends == 2 and ends[2] == #data)
+  local t = msgpack.unpack(data:sub(ends[1] + 1), d)
+  assert(t.name == "b" and t.tags[1] == 2 and t.id == nil)
+  assert(msgpack.packMany(records) ~= expected)
+  assert(not pcall(msgpack.packMany, records, {dictionary = {}}))
+end
+
+-- A Dictionary as a field of a record is a value, not an option.
+do
+  local r = msgpack.compile{"x", y = "array"}
+  assert(not pcall(r.pack, r, {x = d}))
+  local ok, err = pcall(r.pack, r, {y = d})
+  assert(not ok and err:find("Arguments must be tables.", 1, true))
+  assert(msgpack.unpack(r:pack({x = 1})).x == 1)
+end
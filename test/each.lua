@@ -0,0 +1,70 @@
+-- Unpacker:each passing deserialized objects to a function.
+require "msgpack"
+
+local data = msgpack.pack(1, 2, 3, 4, 5, {6}, "seven")
+
+-- Without a batch size, each object is passed alone, and the number of
+-- objects is returned.
+do
+  local u = msgpack.Unpacker()
+  u:feed(data)
+  local v = {}
+  assert(u:each(function (x) v[#v + 1] = x end) == 7)
+  assert(#v == 7 and v[6][1] == 6 and v[7] == "seven")
+  assert(u:each(function () error("no object") end) == 0)
+  assert(u:each(function () end, 0) == 0)
+end
+
+-- Objects are passed as arrays of the batch size, except for the last one.
+for batch = 1, 8 do
+  local u = msgpack.Unpacker()
+  u:feed(data)
+  local batches, all = {}, {}
+  assert(u:each(function (vs)
+    assert(#vs >= 1 and #vs <= batch)
+    batches[#batches + 1] = #vs
+    for _, x in ipairs(vs) do all[#all + 1] = x end
+  end, batch) == 7)
+  assert(#batches == math.ceil(7 / batch))
+  for i = 1, #batches - 1 do assert(batches[i] == batch) end
+  assert(#all == 7 and all[5] == 5 and all[7] == "seven")
+end
+
+-- Objects are read through the feeding function.
+do
+  local pieces = {data:sub(1, 3), data:sub(4, 9), data:sub(10)}
+  local u = msgpack.Unpacker(function () return table.remove(pieces, 1) end)
+  local n = 0
+  assert(u:each(function (vs) n = n + #vs end, 3) == 7)
+  assert(n == 7)
+end
+
+-- An incomplete object is kept for the next call.
+do
+  local u = msgpack.Unpacker()
+  u:feed(data:sub(1, -2))
+  assert(u:each(function () end) == 6)
+  u:feed(data:sub(-1))
+  assert(u:each(function (x) assert(x == "seven") end) == 1)
+end
+
+-- Errors of the function and malformed data are raised, and objects
+-- before them have been consumed.
+do
+  local u = msgpack.Unpacker()
+  u:feed(msgpack.pack(1, 2, 3))
+  local ok, err = pcall(u.each, u, function (x)
+    if x == 2 then error("stop") end
+  end)
+  assert(not ok and err:find("stop", 1, true))
+  assert(u:next() == 3)
+
+  u:feed(msgpack.pack(4) .. "\193")
+  local v = {}
+  ok, err = pcall(u.each, u, function (x) v[#v + 1] = x end)
+  assert(not ok and err:find("deserialization failed", 1, true))
+  assert(#v == 1 and v[1] == 4)
+
+  assert(not pcall(u.each, u, function () end, -1))
+  assert(not pcall(u.each, u, "not a function"))
+end
@@ -0,0 +1,47 @@
+-- Ext types registered from Lua.
+require "msgpack"
+
+local E = {}
+local function encode(v) return v.s end
+local function decode(s) return setmetatable({s = s}, E) end
+
+-- Negative and reserved types cannot be registered.
+for _, t in ipairs({-1, -128, 16, 47, 128}) do
+  assert(not pcall(msgpack.registerExt, t, E, encode, decode))
+end
+msgpack.registerExt(0, E, encode, decode)
+assert(msgpack.unpack(msgpack.pack(setmetatable({s = "x"}, E))).s == "x")
+
+-- A decoder cannot use the Unpacker deserializing the object, and the
+-- Unpacker is usable afterwards.
+do
+  local u = msgpack.Unpacker()
+  local use
+  local R = {}
+  msgpack.registerExt(1, R, encode, function (s)
+    use(u)
+    return s
+  end)
+  local data = msgpack.pack({setmetatable({s = "r"}, R)})
+  for _, f in ipairs({
+    function (u) u:feed(data) end,
+    function (u) u:next() end,
+    function (u) u:nextView() end,
+    function (u) u:each(print) end,
+  }) do
+    use = f
+    u:feed(data)
+    local ok, err = pcall(u.next, u)
+    assert(not ok and err:find("while it is deserializing", 1, true), err)
+    assert(u:next() == nil)
+  end
+
+  use = function () end
+  u:feed(data, msgpack.pack(1))
+  assert(u:next()[1] == "r" and u:next() == 1)
+
+  use = function () error("bad payload") end
+  u:feed(data)
+  local ok, err = pcall(u.next, u)
+  assert(not ok and err:find("bad payload", 1, true), err)
+end
@@ -0,0 +1,89 @@
+-- Unpackers calling feeding functions when they need more data.
+require "msgpack"
+
+local function fails(pattern, f, ...)
+  local ok, err = pcall(f, ...)
+  assert(not ok, "expected an error")
+  assert(err:find(pattern, 1, true), err)
+end
+
+-- Returns a feeding function passing data in pieces of the given size.
+local function pieces(data, size)
+  local pos = 1
+  local calls = 0
+  return function ()
+    calls = calls + 1
+    if pos > #data then return nil end
+    local s = data:sub(pos, pos + size - 1)
+    pos = pos + size
+    return s
+  end, function () return calls end
+end
+
+local data = msgpack.pack({1, 2, 3}, "string", {a = {b = "c"}}, 4)
+
+-- An object lying across pieces is deserialized once it is complete.
+for size = 1, #data do
+  local u = msgpack.Unpacker((pieces(data, size)))
+  local v = {}
+  for x in u do v[#v + 1] = x end
+  assert(#v == 4 and v[1][3] == 3 and v[2] == "string")
+  assert(v[3].a.b == "c" and v[4] == 4)
+  assert(u:next() == nil)
+end
+
+-- A feeding function is called only when the buffer lacks a complete
+-- object, and is called again after it returns nil.
+do
+  local feeder, calls = pieces(msgpack.pack(1, 2), 100)
+  local u = msgpack.Unpacker(feeder)
+  assert(u:next() == 1 and calls() == 1)
+  assert(u:next() == 2 and calls() == 1)
+  assert(u:next() == nil and calls() == 2)
+  assert(u() == nil and calls() == 3)
+end
+
+-- A feeding function given to next or to the for loop is used instead.
+do
+  local u = msgpack.Unpacker(function () error("not used") end)
+  assert(u:next((pieces(msgpack.pack(5), 1))) == 5)
+
+  u = msgpack.Unpacker()
+  local v = {}
+  for x in u, (pieces(msgpack.pack(6, 7), 1)) do v[#v + 1] = x end
+  assert(#v == 2 and v[1] == 6 and v[2] == 7)
+  assert(u:next() == nil)
+end
+
+-- The Unpacker is passed to the feeding function, which may feed data
+-- instead of returning it.
+do
+  local rest = {msgpack.pack("a"), msgpack.pack("b")}
+  local u
+  u = msgpack.Unpacker(function (self)
+    assert(self == u)
+    local s = table.remove(rest, 1)
+    if s ~= nil then self:feed(s) end
+  end)
+  assert(u:next() == "a" and u:next() == "b" and u:next() == nil)
+end
+
+-- Other return values and errors of the feeding function are errors, and
+-- the Unpacker stays usable.
+do
+  local u = msgpack.Unpacker(function () return 1 end)
+  fails("feeding function must return a string or nil", u.next, u)
+  u = msgpack.Unpacker(function () error("feeder failed") end)
+  u:feed(msgpack.pack(1, {2}):sub(1, -2))
+  assert(u:next() == 1)
+  fails("feeder failed", u.next, u)
+  u:feed("\2")
+  assert(u:next()[1] == 2)
+end
+
+-- Data from a feeding function counts towards max_buffer_size.
+do
+  local u = msgpack.Unpacker(function () return ("\0"):rep(10) end,
+                             {max_buffer_size = 4})
+  fails("buffer size exceeds the limit", u.next, u)
+end
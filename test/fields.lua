@@ -0,0 +1,85 @@
+-- Deserialization of selected fields of maps.
+require "msgpack"
+
+local function fails(pattern, f, ...)
+  local ok, err = pcall(f, ...)
+  assert(not ok, "expected an error")
+  assert(err:find(pattern, 1, true), err)
+end
+
+local rec = {id = 1, ts = 100, body = "large",
+             user = {name = "u", email = "e", roles = {"a"}}}
+local data = msgpack.pack(rec)
+
+-- Names in the array part select entries entirely, and names in the hash
+-- part select entries deserialized with the nested fields.
+do
+  local t = msgpack.unpack(data, {fields = {"id", "user"}})
+  assert(t.id == 1 and t.ts == nil and t.body == nil)
+  assert(t.user.name == "u" and t.user.roles[1] == "a")
+
+  t = msgpack.unpack(data, {fields = {"ts", user = {"name", "roles"}}})
+  assert(t.ts == 100 and t.id == nil)
+  assert(t.user.name == "u" and t.user.email == nil and t.user.roles[1] == "a")
+
+  t = msgpack.unpack(data, {fields = {"none"}})
+  assert(next(t) == nil)
+end
+
+-- An empty list selects no entry.
+do
+  local t = msgpack.unpack(data, {fields = {}})
+  assert(type(t) == "table" and next(t) == nil)
+  t = msgpack.unpack(data, {fields = {user = {}}})
+  assert(next(t.user) == nil and t.id == nil)
+end
+
+-- Fields apply to every object and to maps in arrays, while scalars and
+-- non-string keys are kept or skipped as they are.
+do
+  local s = msgpack.pack({{id = 1, x = 2}, {id = 3, x = 4}}, 5,
+                         {[1] = "a", [2] = "b", id = 6})
+  local a, b, c = msgpack.unpack(s, {fields = {"id"}})
+  assert(#a == 2 and a[1].id == 1 and a[1].x == nil and a[2].id == 3)
+  assert(b == 5)
+  assert(c.id == 6 and c[1] == nil)
+
+  local all = msgpack.unpackToArray(s, {fields = {"x"}})
+  assert(#all == 3 and all[2] == 5 and all[1][2].x == 4)
+end
+
+-- Unpackers apply fields to each object.
+do
+  local u = msgpack.Unpacker({fields = {"id", user = {"name"}}})
+  u:feed(data .. data:sub(1, 10))
+  local t = u:next()
+  assert(t.id == 1 and t.body == nil and t.user.name == "u")
+  assert(u:next() == nil)
+  u:feed(data:sub(11))
+  t = u:next()
+  assert(t.user.email == nil and t.user.name == "u")
+end
+
+-- Fields select keys of a Dictionary as well.
+do
+  local d = msgpack.Dictionary{"id", "user", "name"}
+  local s = msgpack.Packer{dictionary = d}:pack(rec)
+  local t = msgpack.unpack(s, {dictionary = d, fields = {user = {"name"}}})
+  assert(t.id == nil and t.user.name == "u" and t.user.email == nil)
+end
+
+-- Invalid fields are rejected, and skipped data is still checked.
+do
+  for _, fields in ipairs{"id", {1}, {{"id"}}, {user = "name"},
+                          {user = {true}}} do
+    fails("option 'fields' must be a table of names", msgpack.unpack,
+          data, {fields = fields})
+  end
+  fails("option 'fields' must be a table of names", msgpack.Unpacker,
+        {fields = {1}})
+  fails("deserialization failed", msgpack.unpack, "\130\161a\193\161b\1",
+        {fields = {"b"}})
+  -- An incomplete object is not returned, as without fields.
+  assert(select("#", msgpack.unpack(msgpack.pack(1) .. data:sub(1, -2),
+                                    {fields = {"id"}})) == 1)
+end
@@ -0,0 +1,102 @@
+-- Packers writing serialized data to a file.
+require "msgpack"
+
+local function fails(pattern, f, ...)
+  local ok, err = pcall(f, ...)
+  assert(not ok, "expected an error")
+  assert(err:find(pattern, 1, true), err)
+end
+
+local function read(path)
+  local f = assert(io.open(path, "rb"))
+  local s = f:read("*a")
+  f:close()
+  return s
+end
+
+local path = os.tmpname()
+
+-- Data is written when flush_bytes are buffered, or flush or close is
+-- called.
+do
+  os.remove(path)
+  local p = msgpack.Packer{path = path, flush_bytes = 4}
+  p:pack(1)
+  assert(read(path) == "")
+  p:pack("abc")
+  assert(read(path) == msgpack.pack(1, "abc"))
+  p:pack(2)
+  p:flush()
+  assert(read(path) == msgpack.pack(1, "abc", 2))
+  p:pack(3)
+  p:close()
+  assert(read(path) == msgpack.pack(1, "abc", 2, 3))
+  p:close()
+  fails("attempt to use a closed Packer", p.pack, p, 4)
+  fails("attempt to use a closed Packer", p.flush, p)
+end
+
+-- Data is written when flush_records objects are buffered. Each object of
+-- pack and packMany counts.
+do
+  os.remove(path)
+  local p = msgpack.Packer{path = path, flush_records = 3,
+                           flush_bytes = 1024}
+  p:pack(1, 2)
+  assert(read(path) == "")
+  p:pack(3)
+  assert(read(path) == msgpack.pack(1, 2, 3))
+  p:packMany({4, 5})
+  assert(#read(path) == 3)
+  p:pack(6)
+  assert(read(path) == msgpack.pack(1, 2, 3, 4, 5, 6))
+  p:close()
+end
+
+-- The data of a failed call is never written, and the counts are kept.
+do
+  os.remove(path)
+  local p = msgpack.Packer{path = path, flush_records = 2,
+                           flush_bytes = 1024}
+  p:pack(1)
+  assert(not pcall(p.pack, p, {2, print}))
+  assert(not pcall(p.packMany, p, {3, print}))
+  assert(read(path) == "")
+  p:pack(4)
+  assert(read(path) == msgpack.pack(1, 4))
+  p:close()
+end
+
+-- Files are appended to, and data is written when the Packer is
+-- collected.
+do
+  local p = msgpack.Packer{path = path}
+  p:pack("appended")
+  p = nil
+  collectgarbage()
+  collectgarbage()
+  local v = msgpack.unpackToArray(read(path))
+  assert(#v == 3 and v[3] == "appended")
+end
+
+-- Invalid or conflicting destinations are rejected.
+do
+  fails("option 'fd' must be a file descriptor", msgpack.Packer, {fd = -1})
+  fails("option 'fd' must be a file descriptor", msgpack.Packer, {fd = {}})
+  fails("option 'path' must be a string", msgpack.Packer, {path = 1})
+  fails("only one of callback, fd and path can be given", msgpack.Packer,
+        {fd = 1, path = path})
+  fails("only one of callback, fd and path can be given", msgpack.Packer,
+        function () end, {path = path})
+end
+
+-- Offsets cannot be returned, and a file which cannot be opened is an
+-- error.
+do
+  local p = msgpack.Packer{path = path}
+  fails("option 'offsets' requires a Packer returning data", p.packMany, p,
+        {1}, {offsets = true})
+  p:close()
+  fails(path .. "/missing: ", msgpack.Packer, {path = path .. "/missing"})
+  os.remove(path)
+end
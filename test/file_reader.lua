@@ -0,0 +1,89 @@
+-- msgpack.open reading objects from a mapped file.
+require "msgpack"
+
+local function fails(pattern, f, ...)
+  local ok, err = pcall(f, ...)
+  assert(not ok, "expected an error")
+  assert(err:find(pattern, 1, true), err)
+end
+
+local function write(path, data)
+  local f = assert(io.open(path, "wb"))
+  f:write(data)
+  f:close()
+end
+
+local path = os.tmpname()
+local data = msgpack.pack(1, "two", {3, {4}}, {five = 5})
+
+-- Objects are read in order by next, by calling the reader, or by the
+-- for loop, until the end of the file.
+do
+  write(path, data)
+  local r = assert(msgpack.open(path))
+  assert(r:next() == 1 and r() == "two")
+  local rest = {}
+  for v in r do rest[#rest + 1] = v end
+  assert(#rest == 2 and rest[1][2][1] == 4 and rest[2].five == 5)
+  assert(r:next() == nil and r:tell() == #data)
+  r:close()
+end
+
+-- tell and seek use offsets in bytes from the beginning of the file.
+do
+  local r = assert(msgpack.open(path))
+  local offsets = {}
+  repeat offsets[#offsets + 1] = r:tell() until r:next() == nil
+  assert(#offsets == 5 and offsets[1] == 0 and offsets[5] == #data)
+  assert(r:seek(offsets[3]) == offsets[3])
+  assert(r:next()[1] == 3)
+  assert(r:seek(0) == 0 and r:next() == 1)
+  assert(r:seek(#data) == #data and r:next() == nil)
+  fails("offset out of range", r.seek, r, #data + 1)
+  fails("offset out of range", r.seek, r, -1)
+  r:close()
+end
+
+-- Values stay valid after the file is closed, and a closed reader is an
+-- error to use. Closing it again does nothing.
+do
+  local r = assert(msgpack.open(path))
+  r:seek(1)
+  local s = r:next()
+  r:close()
+  r:close()
+  assert(s == "two")
+  fails("attempt to use a closed file", r.next, r)
+  fails("attempt to use a closed file", r.seek, r, 0)
+  fails("attempt to use a closed file", r.tell, r)
+end
+
+-- An incomplete object at the end is not returned, and malformed data is
+-- an error.
+do
+  write(path, data:sub(1, -2))
+  local r = assert(msgpack.open(path))
+  local n = 0
+  for v in r do n = n + 1 end
+  assert(n == 3)
+  r:close()
+
+  write(path, msgpack.pack(1) .. "\193")
+  r = assert(msgpack.open(path))
+  assert(r:next() == 1)
+  fails("deserialization failed: invalid type", r.next, r)
+  r:close()
+end
+
+-- An empty file has no objects, and a missing file returns nil and the
+-- reason.
+do
+  write(path, "")
+  local r = assert(msgpack.open(path))
+  assert(r:next() == nil and r:tell() == 0)
+  r:close()
+
+  os.remove(path)
+  local none, err = msgpack.open(path)
+  assert(none == nil and err:find(path, 1, true))
+end
@@ -0,0 +1,70 @@
+-- Limits checked by an Unpacker fed a stream in pieces.
+require "msgpack"
+
+local function feedInPieces(u, data, size)
+  for i = 1, #data, size do
+    u:feed(data:sub(i, i + size - 1))
+  end
+end
+
+-- An object lying across fed strings is counted once.
+do
+  local data = msgpack.pack({"abcdefgh", "ijklmnop", {1, 2}})
+  local u = msgpack.Unpacker{max_objects = 6}
+  local t = {}
+  for i = 1, #data do
+    u:feed(data:sub(i, i))
+    local v = u:next()
+    if v ~= nil then t[#t + 1] = v end
+  end
+  assert(#t == 1)
+  assert(t[1][1] == "abcdefgh" and t[1][3][2] == 2)
+end
+
+-- A string is rejected by its header before its payload is fed.
+do
+  local u = msgpack.Unpacker{max_string_length = 4}
+  u:feed(msgpack.pack("abcdefgh"):sub(1, 2))
+  local ok, err = pcall(u.next, u)
+  assert(not ok and err:find("string too long"))
+end
+
+-- The buffered data is discarded after an error, and the Unpacker can be
+-- fed a new stream.
+do
+  local u = msgpack.Unpacker{max_objects = 3}
+  feedInPieces(u, msgpack.pack({1, 2, 3}), 2)
+  local ok, err = pcall(u.next, u)
+  assert(not ok and err:find("too many objects"))
+  assert(u:next() == nil)
+
+  feedInPieces(u, msgpack.pack({1, 2}, "x"), 2)
+  assert(u:next()[2] == 2)
+  assert(u:next() == "x")
+  assert(u:next() == nil)
+end
+
+-- The same applies to malformed data.
+do
+  local u = msgpack.Unpacker()
+  u:feed("\193" .. msgpack.pack(1))
+  assert(not pcall(u.next, u))
+  u:feed(msgpack.pack(2))
+  assert(u:next() == 2)
+end
+
+-- Sizes too large for size_t mean no limit, and NaN is rejected.
+do
+  local data = msgpack.pack({1, {2}})
+  local t = msgpack.unpack(data, {max_buffer_size = math.huge,
+                                  max_depth = 2 ^ 70})
+  assert(t[2][1] == 2)
+  local u = msgpack.Unpacker{max_elements = math.huge}
+  u:feed(data)
+  assert(u:next()[1] == 1)
+  assert(#msgpack.Packer{max_depth = math.huge}:pack({{}}) == 2)
+
+  local ok, err = pcall(msgpack.unpack, data, {max_objects = 0 / 0})
+  assert(not ok and err:find("option 'max_objects' must be", 1, true))
+  assert(not pcall(msgpack.Unpacker, {max_depth = -math.huge}))
+end
@@ -0,0 +1,103 @@
+-- Numeric arrays packed as ext objects of types 0x10, 0x11 and 0x12.
+require "msgpack"
+
+local function fails(pattern, f, ...)
+  local ok, err = pcall(f, ...)
+  assert(not ok, "expected an error")
+  assert(err:find(pattern, 1, true), err)
+end
+
+local function equal(a, b)
+  if #a ~= #b then return false end
+  for i = 1, #a do
+    if a[i] ~= b[i] and (a[i] == a[i] or b[i] == b[i]) then return false end
+  end
+  return true
+end
+
+-- The payload is the numbers in big endian, and the ext type tells their
+-- type.
+do
+  assert(msgpack.packNumbers({1, -2}, "int32") ==
+         "\199\8\17" .. "\0\0\0\1" .. "\255\255\255\254")
+  assert(msgpack.packNumbers({1}, "int64") ==
+         "\199\8\18" .. "\0\0\0\0\0\0\0\1")
+  assert(msgpack.packNumbers({1.5}) == "\199\8\16" .. "\63\248\0\0\0\0\0\0")
+  assert(msgpack.packNumbers({}, "int32") == "\199\0\17")
+end
+
+-- Arrays of any size are round-tripped, with ext 16 and ext 32 headers.
+for _, n in ipairs{0, 1, 31, 32, 511, 512, 513, 8191, 8192, 20000} do
+  local t = {}
+  for i = 1, n do t[i] = (i % 2 == 0 and -1 or 1) * i end
+  for _, type in ipairs{"float64", "int32", "int64"} do
+    local data = msgpack.packNumbers(t, type)
+    local size = n * (type == "int32" and 4 or 8)
+    local header = size < 256 and "\199" or size < 65536 and "\200" or
+                   "\201"
+    assert(data:sub(1, 1) == header)
+    assert(equal(msgpack.unpack(data), t))
+  end
+end
+
+-- float64 keeps every double, including NaN, infinities and -0.
+do
+  local zero = 0
+  local t = {0 / 0, math.huge, -math.huge, -zero, 2 ^ -1074, 1e308, 0.1}
+  local u = msgpack.unpack(msgpack.packNumbers(t))
+  assert(equal(u, t) and u[1] ~= u[1] and 1 / u[4] == -math.huge)
+end
+
+-- Integers keep their values within their ranges.
+do
+  local t = {-2 ^ 31, 2 ^ 31 - 1, 0}
+  assert(equal(msgpack.unpack(msgpack.packNumbers(t, "int32")), t))
+  t = {-2 ^ 63, 2 ^ 53, -2 ^ 53, 2 ^ 62}
+  assert(equal(msgpack.unpack(msgpack.packNumbers(t, "int64")), t))
+end
+
+-- Numbers out of the range of the type, fractions and NaN are rejected,
+-- as are values other than numbers.
+do
+  for _, v in ipairs{2 ^ 31, -2 ^ 31 - 1, 1.5, 0 / 0, math.huge} do
+    fails("out of the range of int32", msgpack.packNumbers, {1, v}, "int32")
+  end
+  for _, v in ipairs{2 ^ 63, -2 ^ 64, 0.5, 0 / 0, -math.huge} do
+    fails("out of the range of int64", msgpack.packNumbers, {v}, "int64")
+  end
+  local t = {}
+  for i = 1, 600 do t[i] = i end
+  t[555] = 2 ^ 40
+  fails("out of the range of int32", msgpack.packNumbers, t, "int32")
+  t[555] = "555"
+  fails("non-number at 555", msgpack.packNumbers, t, "int32")
+  fails("non-number at 2", msgpack.packNumbers, {1, {}})
+  fails("invalid numeric type", msgpack.packNumbers, {1}, "int16")
+  fails("invalid numeric type", msgpack.numbers, {1}, "double")
+end
+
+-- Marked tables are packed as numeric arrays wherever they are.
+do
+  local v = msgpack.numbers({1, 2, 3}, "int32")
+  assert(msgpack.numbers(v) == v)
+  v = msgpack.numbers({1, 2, 3}, "int32")
+  local data = msgpack.pack({values = v, plain = {1, 2, 3}})
+  assert(data:find(msgpack.packNumbers({1, 2, 3}, "int32"), 1, true))
+  local t = msgpack.unpack(data)
+  assert(equal(t.values, {1, 2, 3}) and equal(t.plain, {1, 2, 3}))
+  assert(getmetatable(t.values) == nil)
+
+  local p = msgpack.Packer()
+  fails("out of the range of int32", p.pack, p,
+        {msgpack.numbers({0.5}, "int32")})
+  assert(p:pack(msgpack.numbers({0.5})) == msgpack.packNumbers({0.5}))
+end
+
+-- Payloads not made of whole numbers are malformed.
+do
+  fails("invalid numeric array", msgpack.unpack, "\199\3\17\0\0\0")
+  fails("invalid numeric array", msgpack.unpack, "\199\4\18\0\0\0\0")
+  local u = msgpack.Unpacker()
+  u:feed("\199\5\16\0\0\0\0\0" .. msgpack.pack(1))
+  assert(not pcall(u.next, u))
+end
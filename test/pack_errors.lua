@@ -0,0 +1,76 @@
+-- Errors raised while packing, which leave packers usable.
+require "msgpack"
+
+local function fails(pattern, f, ...)
+  local ok, err = pcall(f, ...)
+  assert(not ok, "expected an error")
+  assert(err:find(pattern, 1, true), err)
+end
+
+-- Cycles are detected, while a table shared by siblings is not a cycle.
+do
+  local t = {1}
+  t[2] = t
+  fails("containing itself", msgpack.pack, t)
+  local m = {}
+  m.self = {m}
+  fails("containing itself", msgpack.pack, m)
+  fails("containing itself", msgpack.pack, {[m] = 1})
+
+  local s = {1, 2}
+  local v = msgpack.unpack(msgpack.pack({s, s, {a = s}}))
+  assert(v[1][2] == 2 and v[2][1] == 1 and v[3].a[2] == 2)
+end
+
+-- The depth limit applies to nested tables.
+do
+  local p = msgpack.Packer{max_depth = 3}
+  assert(p:pack({{{1}}}))
+  fails("too deeply nested", p.pack, p, {{{{1}}}})
+  local t = {}
+  for i = 1, 1000 do t = {t} end
+  assert(#msgpack.pack(t) > 1000)
+end
+
+-- Errors of ext encoders are raised by pack.
+do
+  local E = {}
+  msgpack.registerExt(1, E, function (v)
+    if v.bad then error("bad value") end
+    if v.nostring then return 1 end
+    return "x"
+  end)
+  fails("bad value", msgpack.pack, {1, setmetatable({bad = true}, E)})
+  fails("must return a string", msgpack.pack, setmetatable({nostring = true}, E))
+  assert(#msgpack.pack(setmetatable({}, E)) > 0)
+end
+
+-- Packers are usable after errors.
+do
+  local p = msgpack.Packer()
+  for i = 1, 3 do
+    fails("invalid type for pack", p.pack, p, {1, function () end})
+    fails("Arguments must be tables.", p.packTable, p, 1)
+    fails("non-number", msgpack.packNumbers, {1, "x"})
+    assert(msgpack.unpack(p:pack({1, {2}}))[2][1] == 2)
+  end
+
+  local r = msgpack.compile{"a"}
+  fails("invalid type for pack", r.pack, r, {a = function () end})
+  assert(msgpack.unpack(r:pack({a = 1})).a == 1)
+
+  local data, ends = p:packMany({1, {2}}, {offsets = true})
+  assert(#ends == 2 and ends[2] == #data)
+  fails("invalid type for pack", p.packMany, p, {1, print}, {offsets = true})
+
+  local out = {}
+  local s = msgpack.Packer(function (x) out[#out + 1] = x end)
+  s:pack(1)
+  fails("invalid type for pack", s.pack, s, 2, print)
+  s:pack(3)
+  fails("option 'offsets' requires a Packer returning data",
+        s.packMany, s, {4}, {offsets = true})
+  s:flush()
+  local v = msgpack.unpackToArray(table.concat(out))
+  assert(#v == 2 and v[1] == 1 and v[2] == 3)
+end
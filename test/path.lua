@@ -0,0 +1,65 @@
+-- Values read by get and compiled paths without deserializing the others.
+require "msgpack"
+
+local function fails(pattern, f, ...)
+  local ok, err = pcall(f, ...)
+  assert(not ok, "expected an error")
+  assert(err:find(pattern, 1, true), err)
+end
+
+local data = msgpack.pack({
+  user = {name = "u", items = {{price = 10}, {price = 20}, {price = 30}}},
+  [2] = "two", [true] = "yes",
+})
+
+-- Keys are names, indices of arrays and other values of map keys.
+do
+  assert(msgpack.get(data, "user", "items", 3, "price") == 30)
+  assert(msgpack.get(data, "user", "name") == "u")
+  assert(msgpack.get(data, 2) == "two" and msgpack.get(data, true) == "yes")
+  local items = msgpack.get(data, "user", "items")
+  assert(#items == 3 and items[2].price == 20)
+  assert(msgpack.get(data).user.name == "u")
+end
+
+-- Missing keys and keys of scalars give nil.
+do
+  assert(msgpack.get(data, "user", "items", 4) == nil)
+  assert(msgpack.get(data, "user", "items", 0) == nil)
+  assert(msgpack.get(data, "user", "items", 1.5) == nil)
+  assert(msgpack.get(data, "user", "items", "1") == nil)
+  assert(msgpack.get(data, "user", "name", "x") == nil)
+  assert(msgpack.get(data, "nobody") == nil)
+end
+
+-- Compiled paths give the same values.
+do
+  assert(msgpack.path("user.items[3].price")(data) == 30)
+  assert(msgpack.path("user.items[1]")(data).price == 10)
+  assert(msgpack.path("user.name")(data) == "u")
+  assert(msgpack.path("[1]")(msgpack.pack({"a", "b"})) == "a")
+  assert(msgpack.path("user.items[4]")(data) == nil)
+  assert(msgpack.path("user.items[007]")(data) == nil)
+end
+
+-- Bad paths are rejected when they are compiled.
+do
+  for _, path in ipairs{"", "a.", ".a", "a..b", "a.[1]", "[1].", "[1]a",
+                        "a[x]", "a[]", "a[1", "a[-1]", "a[+1]", "a[ 3]",
+                        "a[3 ]", "a[0x1]", "a[1.5]", "a[4294967296]",
+                        "a[99999999999999999999]"} do
+    fails("invalid path", msgpack.path, path)
+  end
+  assert(msgpack.path("a[4294967295]")(data) == nil)
+end
+
+-- Malformed or incomplete data raises an error.
+do
+  local nested = msgpack.pack({user = {items = {1, 2, 3}}})
+  fails("deserialization failed: incomplete data", msgpack.get,
+        nested:sub(1, -2), "user", "items", 3)
+  fails("deserialization failed: invalid type", msgpack.get,
+        "\129\161a\193", "a")
+  fails("deserialization failed: incomplete data", msgpack.get, "")
+  assert(msgpack.get(nested:sub(1, -2), "user", "items", 2) == 2)
+end
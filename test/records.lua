@@ -0,0 +1,87 @@
+-- Packers compiled from schemas of records.
+require "msgpack"
+
+local function fails(pattern, f, ...)
+  local ok, err = pcall(f, ...)
+  assert(not ok, "expected an error")
+  assert(err:find(pattern, 1, true), err)
+end
+
+-- Returns the keys of the serialized map in their order.
+local function keysOf(data)
+  local keys = {}
+  for k in msgpack.pairs(msgpack.view(data)) do keys[#keys + 1] = k end
+  return table.concat(keys, ",")
+end
+
+local user = msgpack.compile{"id", "name"}
+local event = msgpack.compile{"id", "ts", tags = "array", meta = "table",
+                              user = user, extra = "any"}
+
+-- A record is a map of all the fields in the order of the schema, and
+-- fields in the hash part follow in the order of their names.
+do
+  local data = event:pack({id = 1, ts = 100, tags = {"a", "b"},
+                           meta = {1, 2}, user = {id = 2, name = "n"},
+                           extra = {x = {1}}, ignored = true})
+  assert(keysOf(data) == "id,ts,extra,meta,tags,user")
+  local t = msgpack.unpack(data)
+  assert(t.id == 1 and t.ts == 100 and t.ignored == nil)
+  assert(#t.tags == 2 and t.tags[2] == "b")
+  assert(t.meta[1] == 1 and t.meta[2] == 2)
+  assert(t.user.id == 2 and t.user.name == "n" and t.extra.x[1] == 1)
+end
+
+-- array and table pack values as packArray and packTable do.
+do
+  local data = event:pack({tags = {"a", x = "ignored"}, meta = {"m"}})
+  local v = msgpack.view(data)
+  assert(#v.tags == 1 and v.tags[1] == "a")
+  assert(type(v.meta) == "userdata" and v.meta[1] == "m")
+  assert(data:sub(-6) == msgpack.pack("user") .. "\192")
+end
+
+-- Missing fields are packed as nil, so every record has all the keys.
+do
+  local data = user:pack({})
+  assert(data == "\130" .. msgpack.pack("id") .. "\192" ..
+         msgpack.pack("name") .. "\192")
+  assert(#msgpack.view(data) == 2)
+end
+
+-- Several records are packed into one string.
+do
+  local a, b = msgpack.unpack(user:pack({id = 1}, {id = 2, name = "b"}))
+  assert(a.id == 1 and b.id == 2 and b.name == "b")
+  assert(user:pack() == "")
+end
+
+-- Values of "any" fields are packed as pack does, including tables
+-- nested in them and ext objects.
+do
+  local any = msgpack.compile{"v"}
+  for _, v in ipairs{true, 1.5, -3, "s", {1, {2}}, {k = {"v"}}} do
+    assert(any:pack({v = v}) == msgpack.pack({v = v}))
+  end
+end
+
+-- Errors in values leave the packer usable.
+do
+  fails("invalid type for pack", user.pack, user, {id = print})
+  fails("Arguments must be tables.", user.pack, user, 1)
+  fails("Arguments must be tables.", event.pack, event, {tags = 1})
+  fails("Arguments must be tables.", event.pack, event, {user = "u"})
+  assert(msgpack.unpack(user:pack({id = 3})).id == 3)
+end
+
+-- Invalid schemas are rejected.
+do
+  fails("field names must be strings", msgpack.compile, {1})
+  fails("field names must be strings", msgpack.compile, {[true] = "any"})
+  fails("invalid way to pack field 'x': list", msgpack.compile,
+        {x = "list"})
+  fails("invalid way to pack field 'x'", msgpack.compile, {x = 1})
+  fails("duplicate field 'id'", msgpack.compile, {"id", "id"})
+  fails("duplicate field 'id'", msgpack.compile, {"id", id = "any"})
+  fails("bad argument", msgpack.compile, "id")
+end
@@ -0,0 +1,112 @@
+-- Round trips of objects packed in dedup mode, whose references are
+-- numbered in the same order by packing and unpacking.
+require "msgpack"
+
+local p = msgpack.Packer{dedup = true}
+
+local function roundTrip(v)
+  return msgpack.unpack(p:pack(v))
+end
+
+-- shared tables
+do
+  local s = {1, 2}
+  local m = {k = "v"}
+  local t = roundTrip({s, m, s, {m, s}})
+  assert(t[1] == t[3] and t[1] == t[4][2] and t[2] == t[4][1])
+  assert(t[1][2] == 2 and t[2].k == "v")
+end
+
+-- self-cycles
+do
+  local a = {1}
+  a[2] = a
+  local t = roundTrip(a)
+  assert(t[2] == t and t[1] == 1)
+
+  local m = {name = "node"}
+  m.self = m
+  m.children = {m, {parent = m}}
+  t = roundTrip(m)
+  assert(t.self == t and t.children[1] == t and t.children[2].parent == t)
+end
+
+-- strings of 4 or more bytes, as keys and values
+do
+  local t = roundTrip({
+    {name = "long value", abc = "abc"},
+    {name = "long value", abc = "abcd"},
+    {abcd = "name"},
+  })
+  assert(t[1].name == "long value" and t[2].name == "long value")
+  assert(t[1].abc == "abc" and t[2].abc == "abcd")
+  assert(t[3].abcd == "name")
+
+  local keys = {}
+  for i = 1, 3 do keys[i] = {["key" .. i] = "value" .. i, ["key" .. i .. i] = i} end
+  t = roundTrip({keys, keys[2], "value1", "key11"})
+  assert(t[1][2] == t[2] and t[2].key2 == "value2" and t[2].key22 == 2)
+  assert(t[3] == "value1" and t[4] == "key11")
+end
+
+-- numeric arrays are not numbered
+do
+  local n = msgpack.numbers({1.5, 2.5})
+  local shared = {"after numbers"}
+  local t = roundTrip({n, shared, n, shared, "after numbers"})
+  assert(t[1][2] == 2.5 and t[3][1] == 1.5)
+  assert(t[2] == t[4] and t[2][1] == "after numbers")
+  assert(t[5] == "after numbers")
+end
+
+-- ext objects are not numbered, while their payloads are not looked into
+do
+  local E = {}
+  msgpack.registerExt(1, E, function (v) return v.s end,
+                      function (s) return setmetatable({s = s}, E) end)
+  local e = setmetatable({s = "payload"}, E)
+  local shared = {"payload"}
+  local t = roundTrip({e, shared, e, shared, "payload"})
+  assert(getmetatable(t[1]) == E and t[1].s == "payload")
+  assert(getmetatable(t[3]) == E and t[3] ~= t[1])
+  assert(t[2] == t[4] and t[5] == "payload")
+end
+
+-- class objects are numbered before their names and fields
+do
+  local Point = {}
+  msgpack.registerClass("Point", Point, {"x", "y", "label"})
+  local a = setmetatable({x = 1, y = 2, label = "origin"}, Point)
+  local b = setmetatable({x = a, y = "Point", label = "origin"}, Point)
+  local t = roundTrip({a, b, a, "Point", b})
+  assert(getmetatable(t[1]) == Point and t[1].x == 1 and t[1].label == "origin")
+  assert(t[2].x == t[1] and t[3] == t[1] and t[5] == t[2])
+  assert(t[2].y == "Point" and t[4] == "Point" and t[2].label == "origin")
+
+  local c = setmetatable({x = 0, y = 0}, Point)
+  c.label = c
+  t = roundTrip(c)
+  assert(t.label == t and getmetatable(t) == Point)
+end
+
+-- packMany numbers each object separately
+do
+  local s = {"shared"}
+  local data = p:packMany({{s, s}, {s}})
+  local t = msgpack.unpackToArray(data)
+  assert(t[1][1] == t[1][2] and t[2][1] ~= t[1][1] and t[2][1][1] == "shared")
+end
+
+-- projections, paths and views do not look into shared objects
+do
+  local data = p:pack({id = 1, user = {name = "name"}})
+  local function fails(pattern, f, ...)
+    local ok, err = pcall(f, ...)
+    assert(not ok and err:find(pattern, 1, true), err)
+  end
+  fails("fields cannot be selected", msgpack.unpack, data, {fields = {"id"}})
+  fails("keys cannot be looked up", msgpack.get, data, "id")
+  fails("keys cannot be looked up", msgpack.path("user.name"), data)
+  fails("cannot view", msgpack.view, data)
+  assert(msgpack.unpack(data).user.name == "name")
+end
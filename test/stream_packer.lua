@@ -0,0 +1,78 @@
+-- Packers passing buffered data to a callback.
+require "msgpack"
+
+local out
+local function collect(data) out[#out + 1] = data end
+
+-- Data is passed when flush_bytes or more bytes are buffered, or flush is
+-- called.
+do
+  out = {}
+  local p = msgpack.Packer(collect, {flush_bytes = 4})
+  assert(p:pack(1) == nil and #out == 0)
+  p:pack("abc")
+  assert(#out == 1 and out[1] == msgpack.pack(1, "abc"))
+  p:pack(2)
+  p:flush()
+  assert(#out == 2 and out[2] == msgpack.pack(2))
+  p:flush()
+  assert(#out == 2)
+  assert(p:close() == nil)
+end
+
+-- Each call passes the data of whole objects.
+do
+  out = {}
+  local p = msgpack.Packer(collect, {flush_bytes = 1})
+  p:pack({1, 2}, "x")
+  p:packMany({3, 4})
+  assert(#out == 2 and out[1] == msgpack.pack({1, 2}, "x"))
+  assert(out[2] == msgpack.pack(3, 4))
+end
+
+-- The data of a failed call is never passed.
+do
+  out = {}
+  local p = msgpack.Packer(collect, {flush_bytes = 1024})
+  p:pack(1)
+  assert(not pcall(p.pack, p, {2, print}))
+  assert(not pcall(p.packMany, p, {3, print}))
+  p:pack(4)
+  p:flush()
+  assert(#out == 1 and out[1] == msgpack.pack(1, 4))
+end
+
+-- Data is emptied before the callback is called, so a failing callback or
+-- one packing data does not make data passed twice.
+do
+  out = {}
+  local p
+  local fail = true
+  p = msgpack.Packer(function (data)
+    if fail then
+      fail = false
+      error("callback failed")
+    end
+    out[#out + 1] = data
+  end)
+  p:pack(1)
+  assert(not pcall(p.flush, p))
+  p:pack(2)
+  p:flush()
+  assert(#out == 1 and out[1] == msgpack.pack(2))
+
+  out = {}
+  local nested = true
+  p = msgpack.Packer(function (data)
+    out[#out + 1] = data
+    if nested then
+      nested = false
+      p:pack("again")
+      p:flush()
+    end
+  end)
+  p:pack(3)
+  p:flush()
+  assert(#out == 2 and out[1] == msgpack.pack(3))
+  assert(out[2] == msgpack.pack("again"))
+end
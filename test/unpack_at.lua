@@ -0,0 +1,65 @@
+-- unpackAt deserializing objects from a position.
+require "msgpack"
+
+local function fails(pattern, f, ...)
+  local ok, err = pcall(f, ...)
+  assert(not ok, "expected an error")
+  assert(err:find(pattern, 1, true), err)
+end
+
+local data = msgpack.pack(1, "two", {3}, {four = 4})
+local positions = select(2, msgpack.count(data, true))
+
+-- One object is returned by default, after the next position.
+do
+  local pos, v = msgpack.unpackAt(data, 1)
+  assert(pos == positions[2] and v == 1)
+  pos, v = msgpack.unpackAt(data, pos)
+  assert(pos == positions[3] and v == "two")
+  pos, v = msgpack.unpackAt(data, positions[4])
+  assert(pos == #data + 1 and v.four == 4)
+end
+
+-- Up to n objects are returned, and fewer at the end of data.
+do
+  local r = {msgpack.unpackAt(data, positions[2], 2)}
+  assert(#r == 3 and r[1] == positions[4] and r[2] == "two" and r[3][1] == 3)
+  r = {msgpack.unpackAt(data, 1, 100)}
+  assert(#r == 5 and r[1] == #data + 1 and r[5].four == 4)
+  r = {msgpack.unpackAt(data, 1, 0)}
+  assert(#r == 1 and r[1] == 1)
+  r = {msgpack.unpackAt(data, #data + 1)}
+  assert(#r == 1 and r[1] == #data + 1)
+end
+
+-- Deserialization stops at an incomplete object, which the position
+-- points to.
+do
+  local cut = data:sub(1, -2)
+  local r = {msgpack.unpackAt(cut, 1, 100)}
+  assert(#r == 4 and r[1] == positions[4])
+  r = {msgpack.unpackAt(cut .. data:sub(-1), r[1], 100)}
+  assert(#r == 2 and r[2].four == 4)
+end
+
+-- The loop of the README reads every object.
+do
+  local all = {}
+  local pos = 1
+  while pos <= #data do
+    local objs = {msgpack.unpackAt(data, pos, 3)}
+    pos = table.remove(objs, 1)
+    if #objs == 0 then break end
+    for _, v in ipairs(objs) do all[#all + 1] = v end
+  end
+  assert(#all == 4 and all[2] == "two")
+end
+
+-- Bad positions and counts, and malformed data, are errors.
+do
+  fails("position out of range", msgpack.unpackAt, data, 0)
+  fails("position out of range", msgpack.unpackAt, data, #data + 2)
+  fails("count must be non-negative", msgpack.unpackAt, data, 1, -1)
+  fails("deserialization failed: invalid type", msgpack.unpackAt,
+        data .. "\193", positions[4], 2)
+end
@@ -0,0 +1,68 @@
+-- validate and count scanning headers of serialized objects.
+require "msgpack"
+
+local function fails(pattern, f, ...)
+  local ok, err = pcall(f, ...)
+  assert(not ok, "expected an error")
+  assert(err:find(pattern, 1, true), err)
+end
+
+local objects = {1, "string", {1, {2, {3}}}, {a = {b = "c"}}, true, 1.5}
+local data = msgpack.pack(unpack(objects))
+
+-- validate returns true and the number of complete objects.
+do
+  local ok, n = msgpack.validate(data)
+  assert(ok == true and n == #objects)
+  ok, n = msgpack.validate("")
+  assert(ok == true and n == 0)
+  ok, n = msgpack.validate(msgpack.packNumbers({1, 2}) ..
+                           msgpack.Packer{dedup = true}:pack({"abcd", "abcd"}))
+  assert(ok == true and n == 2)
+end
+
+-- Otherwise, it returns false, the reason and the position of the broken
+-- object.
+do
+  local prefix = msgpack.pack(1, "string")
+  local ok, reason, pos = msgpack.validate(prefix .. "\145\193")
+  assert(ok == false and reason == "invalid type" and pos == #prefix + 1)
+  -- Data cut at the end of an object is valid.
+  local valid = 0
+  for i = 1, #data - 1 do
+    ok, reason, pos = msgpack.validate(data:sub(1, i))
+    if ok then
+      valid = valid + 1
+    else
+      assert(reason == "incomplete data" and pos <= i)
+    end
+  end
+  assert(valid == #objects - 1)
+  ok, reason, pos = msgpack.validate("\221\255\255\255\255")
+  assert(ok == false and reason == "incomplete data" and pos == 1)
+end
+
+-- count returns the number of objects, and their positions when asked.
+do
+  assert(msgpack.count(data) == #objects)
+  assert(msgpack.count("") == 0)
+  local n, positions = msgpack.count(data, true)
+  assert(n == #objects and #positions == n and positions[1] == 1)
+  for i = 1, n do
+    local v = msgpack.unpack(data:sub(positions[i]))
+    assert(type(v) == type(objects[i]))
+  end
+  assert(data:sub(positions[2], positions[3] - 1) == msgpack.pack("string"))
+  n, positions = msgpack.count("", true)
+  assert(n == 0 and #positions == 0)
+end
+
+-- count raises an error for broken data with its position.
+do
+  local prefix = msgpack.pack(1, 2)
+  fails("deserialization failed: invalid type at 3", msgpack.count,
+        prefix .. "\193")
+  fails("deserialization failed: incomplete data at 3", msgpack.count,
+        prefix .. "\146\1", true)
+  fails("bad argument", msgpack.count, nil)
+end
@@ -0,0 +1,91 @@
+-- Views deserializing elements on demand.
+require "msgpack"
+
+local function fails(pattern, f, ...)
+  local ok, err = pcall(f, ...)
+  assert(not ok, "expected an error")
+  assert(err:find(pattern, 1, true), err)
+end
+
+local data = msgpack.pack({
+  header = {id = 7, tags = {"a", "b"}},
+  items = {10, {20}, "thirty"},
+  [2] = "two",
+})
+
+-- Elements are read by keys, and nested arrays and maps are views.
+do
+  local v = msgpack.view(data)
+  assert(type(v) == "userdata" and #v == 3)
+  assert(v.header.id == 7 and v.header.tags[2] == "b")
+  assert(#v.items == 3 and v.items[1] == 10 and v.items[3] == "thirty")
+  assert(type(v.items[2]) == "userdata" and v.items[2][1] == 20)
+  assert(v[2] == "two" and v[1] == nil)
+  assert(v.none == nil and v.items[4] == nil and v.items[0] == nil)
+  assert(v.items.x == nil and v.header[1] == nil)
+end
+
+-- A view of a scalar is the value itself, and trailing data is ignored.
+do
+  assert(msgpack.view(msgpack.pack("s")) == "s")
+  assert(msgpack.view(msgpack.pack(1, 2)) == 1)
+  assert(#msgpack.view(msgpack.pack({})) == 0)
+end
+
+-- pairs iterates elements in their order in the data.
+do
+  local v = msgpack.view(msgpack.pack({5, {6}, 7}))
+  local keys, values = {}, {}
+  for k, e in msgpack.pairs(v) do
+    keys[#keys + 1] = k
+    values[#values + 1] = e
+  end
+  assert(#keys == 3 and keys[1] == 1 and keys[3] == 3)
+  assert(values[1] == 5 and values[2][1] == 6 and values[3] == 7)
+
+  local n = 0
+  for k, e in msgpack.pairs(msgpack.view(data).header) do
+    n = n + 1
+    assert((k == "id" and e == 7) or (k == "tags" and e[1] == "a"))
+  end
+  assert(n == 2)
+end
+
+-- unpackView deserializes the whole object.
+do
+  local t = msgpack.unpackView(msgpack.view(data).header)
+  assert(type(t) == "table" and t.id == 7 and t.tags[1] == "a")
+end
+
+-- Views of elements keep the data alive after their parents are gone.
+do
+  local items = msgpack.view(msgpack.pack({items = {{1, 2}}})).items
+  collectgarbage()
+  collectgarbage()
+  assert(items[1][2] == 2)
+end
+
+-- Unpacker:nextView returns views of fed objects, including one lying
+-- across fed strings.
+do
+  local u = msgpack.Unpacker()
+  local s = msgpack.pack({1, {2}}, 3)
+  u:feed(s:sub(1, 3))
+  assert(u:nextView() == nil)
+  u:feed(s:sub(4))
+  local v = u:nextView()
+  assert(#v == 2 and v[2][1] == 2)
+  assert(u:nextView() == 3 and u:nextView() == nil)
+  collectgarbage()
+  assert(v[1] == 1)
+end
+
+-- Malformed or incomplete data is rejected before a view is made.
+do
+  fails("deserialization failed: incomplete data", msgpack.view,
+        data:sub(1, -2))
+  fails("deserialization failed: invalid type", msgpack.view, "\145\193")
+  fails("deserialization failed: incomplete data", msgpack.view, "")
+  fails("cannot view a shared object", msgpack.view,
+        msgpack.Packer{dedup = true}:pack({"shared", "shared"}))
+end